@@ -0,0 +1,81 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+/*
+ * One zeroed, cache-aligned block of memory, allocated up front and handed out as arrays that each
+ * start on a cache line of their own. Whatever owns it sizes it with Size() for every array it'll
+ * need, then takes them in its constructor, so nothing gets allocated (or put on the stack) per
+ * spectrum however big the FFT is.
+ */
+class Arena
+{
+	public:
+		static const size_t alignment = 64; //a cache line
+		
+		Arena(size_t bytes) :
+			m_base(0),
+			m_size(bytes),
+			m_used(0)
+		{
+			void *base;
+			if (posix_memalign(&base, alignment, m_size ? m_size : alignment) != 0){
+				throw std::bad_alloc();
+			}
+			memset(base, 0, m_size);
+			m_base = (char *)base;
+		}
+		
+		~Arena()
+		{
+			free(m_base);
+		}
+		
+		/* The room count Ts take up in an arena */
+		template <typename T> static size_t Size(size_t count)
+		{
+			return (count * sizeof(T) + alignment - 1) / alignment * alignment;
+		}
+		
+		/* The next count Ts of the arena */
+		template <typename T> T *Take(size_t count)
+		{
+			if (m_used + Size<T>(count) > m_size){ //sized wrongly
+				throw std::bad_alloc();
+			}
+			T *array = (T *)(m_base + m_used);
+			m_used += Size<T>(count);
+			return array;
+		}
+		
+	private:
+		Arena(const Arena &);
+		Arena &operator=(const Arena &);
+		
+		char *m_base;
+		size_t m_size;
+		size_t m_used;
+};
+
+#endif
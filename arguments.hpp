@@ -16,8 +16,14 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
 */
 
+#include <algorithm>
 #include <stdlib.h>
+#include <string.h>
 #include <argp.h>
+#include <string>
+#include <vector>
+
+#include "detector.hpp"
 
 class Arguments
 {
@@ -33,7 +39,23 @@ class Arguments
 			sample_rate(2000000.0),
 			fft_width(1000.0),
 			step(-1.0),
-			ptime(-1.0)
+			ptime(-1.0),
+			db_average(false),
+			queue_size(16),
+			settle(0),
+			use_tags(false),
+			stitch(0.0),
+			max_signals(100000),
+			max_age(0.0),
+			passes(1),
+			zoom(1),
+			adaptive(false),
+			fft_threads(1),
+			fft_batch(1),
+			metrics_period(5.0),
+			detector("window"),
+			cu8(false),
+			overlap(0.0)
 		{
 			argp_parse (&argp_i, argc, argv, 0, 0, this);
 		}
@@ -90,7 +112,10 @@ class Arguments
 		
 		double get_step()
 		{
-			if (step < 0.0){
+			if ((step < 0.0) && (stitch > 0.0) && (stitch * sample_rate/2.0 > 2.0 * spread)){
+				return stitch * sample_rate/2.0 - spread; //the widest step where the next step still covers this one's centre
+			}
+			else if (step < 0.0){
 				return sample_rate/4.0; //I've found this to be a good choice (slightly faster might be /3.0)
 			}
 			else {
@@ -103,6 +128,118 @@ class Arguments
 			return ptime;
 		}
 		
+		bool get_db_average()
+		{
+			return db_average;
+		}
+		
+		std::vector<std::string> get_devices()
+		{
+			return devices;
+		}
+		
+		std::vector<std::string> get_replays()
+		{
+			return replays;
+		}
+		
+		unsigned int get_queue_size()
+		{
+			return queue_size;
+		}
+		
+		unsigned int get_settle()
+		{
+			return settle;
+		}
+		
+		bool get_use_tags()
+		{
+			return use_tags;
+		}
+		
+		double get_stitch()
+		{
+			return stitch;
+		}
+		
+		unsigned int get_max_signals()
+		{
+			return max_signals;
+		}
+		
+		double get_max_age()
+		{
+			return max_age;
+		}
+		
+		unsigned int get_passes()
+		{
+			return passes;
+		}
+		
+		bool get_adaptive()
+		{
+			return adaptive;
+		}
+		
+		unsigned int get_fft_threads()
+		{
+			return fft_threads;
+		}
+		
+		unsigned int get_fft_batch()
+		{
+			return fft_batch;
+		}
+		
+		std::string get_metrics_target()
+		{
+			return metrics_target;
+		}
+		
+		double get_metrics_period()
+		{
+			return metrics_period;
+		}
+		
+		std::string get_spectrum_log()
+		{
+			return spectrum_log;
+		}
+		
+		std::string get_detector()
+		{
+			return detector;
+		}
+		
+		bool get_cu8()
+		{
+			return cu8;
+		}
+		
+		std::string get_watchlist()
+		{
+			return watchlist;
+		}
+		
+		std::string get_control_socket()
+		{
+			return control_socket;
+		}
+		
+		double get_overlap()
+		{
+			return overlap;
+		}
+		
+		unsigned int get_zoom()
+		{
+			/* the fine window has to cover at least two bins of the quick sweep's FFT to find anything */
+			unsigned int most = std::max(bandwidth1 / (2.0 * fft_width), 1.0);
+			return std::min(zoom, most);
+		}
+		
 	private:
 		static error_t s_parse_opt(int key, char *arg, struct argp_state *state)
 		{
@@ -147,15 +284,112 @@ class Arguments
 				case 'p':
 					ptime = atof(arg);
 					break;
+				case 'd':
+					db_average = true;
+					break;
+				case 'D':
+					devices.push_back(arg);
+					break;
+				case 'R':
+					replays.push_back(arg);
+					break;
+				case 'q':
+					queue_size = std::max(atoi(arg), 0); //so a negative count fails the check at the end too
+					break;
+				case 'S':
+					settle = atoi(arg);
+					break;
+				case 'T':
+					use_tags = true;
+					break;
+				case 'u':
+					stitch = atof(arg);
+					break;
+				case 'm':
+					max_signals = atoi(arg);
+					break;
+				case 'e':
+					max_age = atof(arg);
+					break;
+				case 'l':
+					passes = arg ? atoi(arg) : 0;
+					break;
+				case 'Z':
+					zoom = atoi(arg);
+					break;
+				case 'A':
+					adaptive = true;
+					break;
+				case 'j':
+					fft_threads = std::max(atoi(arg), 1);
+					break;
+				case 'b':
+					fft_batch = std::max(atoi(arg), 1);
+					break;
+				case 'M':
+					metrics_target = arg;
+					break;
+				case 'P':
+					metrics_period = atof(arg);
+					break;
+				case 'L':
+					spectrum_log = arg;
+					break;
+				case 'k':
+					detector = arg;
+					break;
+				case '8':
+					cu8 = true;
+					break;
+				case 'O':
+					overlap = atof(arg);
+					break;
+				case 'K':
+					control_socket = arg;
+					break;
+				case 'W':
+					watchlist = arg;
+					break;
 				case ARGP_KEY_ARG:
-					if (state->arg_num > 0){
-						argp_usage (state);
+					//gr-scan takes no arguments, and a number here is most likely from "-l 3", which argp reads as a bare -l then a stray "3"
+					if (arg[strspn(arg, "0123456789")] == '\0'){
+						argp_error(state, "unexpected argument \"%s\" (the number of passes must be attached to -l, as in -l%s or --loop=%s)", arg, arg, arg);
 					}
+					argp_error(state, "unexpected argument \"%s\"", arg);
 					break;
 				case ARGP_KEY_END:
 					if (state->arg_num < 0){
 						argp_usage(state);
 					}
+					if (!watchlist.empty() && ((zoom > 1) || (stitch > 0.0) || adaptive || !control_socket.empty())){
+						argp_error(state, "--watch can't be used with --zoom, --stitch, --adaptive or --control");
+					}
+					if (!control_socket.empty() && (zoom > 1)){
+						argp_error(state, "--zoom can't be used with --control");
+					}
+					if (!control_socket.empty()){
+						passes = 0; //a daemon sweeps until it's stopped
+					}
+					if ((zoom > 1) && (passes != 1)){
+						argp_error(state, "--zoom can't be used with --loop");
+					}
+#ifndef HAVE_RTLSDR
+					if (cu8 && replays.empty()){
+						argp_error(state, "--cu8 can only replay captures, as gr-scan was built without librtlsdr (make RTLSDR=1 to read RTL devices directly)");
+					}
+#endif
+					if (queue_size < 1){
+						argp_error(state, "--queue must be at least 1");
+					}
+					if (metrics_period <= 0.0){
+						argp_error(state, "--metrics-period must be positive");
+					}
+					if ((overlap < 0.0) || (overlap >= 1.0)){
+						argp_error(state, "--overlap must be at least 0 and less than 1");
+					}
+					if (!KnownDetector(detector)){
+						argp_error(state, "--detector must be window, ca-cfar or os-cfar");
+					}
 					break;
 				default:
 					return ARGP_ERR_UNKNOWN;
@@ -177,6 +411,28 @@ class Arguments
 		double fft_width;
 		double step;
 		double ptime;
+		bool db_average;
+		std::vector<std::string> devices;
+		std::vector<std::string> replays;
+		unsigned int queue_size;
+		unsigned int settle;
+		bool use_tags;
+		double stitch;
+		unsigned int max_signals;
+		double max_age;
+		unsigned int passes;
+		unsigned int zoom;
+		bool adaptive;
+		unsigned int fft_threads;
+		unsigned int fft_batch;
+		std::string metrics_target;
+		double metrics_period;
+		std::string spectrum_log;
+		std::string detector;
+		bool cu8;
+		double overlap;
+		std::string control_socket;
+		std::string watchlist;
 };
 
 argp_option Arguments::options[] = {
@@ -191,6 +447,28 @@ argp_option Arguments::options[] = {
 	{"fft-width", 'w', "COUNT", 0, "Width of FFT in samples"},
 	{"step", 'z', "FREQ", 0, "Increment step in MHz"},
 	{"time", 'p', "TIME", 0, "Time in seconds to scan on each frequency"},
+	{"db-average", 'd', 0, 0, "Average the spectrum in dB after every FFT instead of averaging power and taking the log once"},
+	{"device", 'D', "ARGS", 0, "Scan with the OsmoSDR device ARGS (e.g. rtl=0), give more than once to share the sweep between several devices"},
+	{"replay", 'R', "FILE", 0, "Replay the IQ captures listed in the index FILE instead of using a radio (give more than once to replay as several devices)"},
+	{"queue", 'q', "COUNT", 0, "Number of averaged spectra from each device that can wait for detection"},
+	{"settle", 'S', "COUNT", 0, "Samples to drop after each retune before averaging"},
+	{"tags", 'T', 0, 0, "Wait for the source's rx_freq tag after each retune before dropping the settle samples"},
+	{"stitch", 'u', "FRACTION", 0, "Stitch the middle FRACTION of each step into one spectrum of the whole sweep and look for signals in that"},
+	{"max-signals", 'm', "COUNT", 0, "Remember at most COUNT signals, forgetting the stalest (0 for no limit)"},
+	{"expire", 'e', "TIME", 0, "Forget signals not seen for TIME seconds so they're reported again if they come back (0 never forgets)"},
+	{"zoom", 'Z', "FACTOR", 0, "Sweep quickly with an FFT FACTOR times smaller averaged FACTOR times less, then at full resolution around what that finds"},
+	{"adaptive", 'A', 0, 0, "Stop averaging once it's clear what's in a spectrum, listen longer where there are signals, and (when looping) visit quiet frequencies less often"},
+	{"fft-threads", 'j', "COUNT", 0, "Threads to run the FFTs on"},
+	{"fft-batch", 'b', "COUNT", 0, "Transform COUNT FFTs at a time, sharing each batch out between the FFT threads (otherwise every FFT is split between them)"},
+	{"metrics", 'M', "TARGET", 0, "Publish metrics in the Prometheus text format to the file TARGET, or to whatever connects to the UNIX socket PATH if TARGET is unix:PATH"},
+	{"metrics-period", 'P', "TIME", 0, "Seconds between rewrites of the metrics file (default 5)"},
+	{"spectrum-log", 'L', "FILE", 0, "Append every averaged spectrum to FILE (read it back with gr-scan-log)"},
+	{"detector", 'k', "NAME", 0, "How to decide what's a signal: window (fine window against coarse window, the default), ca-cfar (fine window against the mean of the bins around it) or os-cfar (against their median)"},
+	{"cu8", '8', 0, 0, "Keep the samples as unsigned 8 bit IQ until they're windowed (reading RTL devices directly rather than through OsmoSDR if built with RTLSDR=1, and replaying captures as 8 bit)"},
+	{"overlap", 'O', "FRACTION", 0, "Overlap each FFT with FRACTION of the one before (0.5 averages as many FFTs, to the same variance, in about half the samples)"},
+	{"control", 'K', "PATH", 0, "Run as a daemon, sweeping until interrupted and taking commands on the UNIX socket PATH (which only this user can connect to) to change the range, threshold, averaging, time and gain, or to have found signals sent back"},
+	{"watch", 'W', "FILE", 0, "Instead of sweeping the range, measure just the channels listed in FILE (a centre frequency in MHz and a width in kHz on each line), working out only the bins they need (keep --spread below the channel spacing)"},
+	{"loop", 'l', "PASSES", OPTION_ARG_OPTIONAL, "Sweep PASSES times, given as -lPASSES or --loop=PASSES (or until interrupted, if not given), reporting only the signals that are new, lost or changed from the usual after the first pass"},
 	{0}
 };
 argp Arguments::argp_i = {options, s_parse_opt, 0, 0};
@@ -0,0 +1,205 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef BATCH_FFT_HPP
+#define BATCH_FFT_HPP
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/fft/fft.h>
+#include "kernels.hpp"
+
+/*
+ * Windows, transforms and squares whole batches of frames of samples, turning them into power spectra
+ * (so it stands in for stream_to_vector, fft_vcc and complex_to_mag_squared). The samples are complex
+ * floats, or with cu8 the unsigned 8 bit IQ an RTL dongle gives, which are turned into floats and
+ * windowed in the same pass that copies them into the FFT. Every call gets at least batch frames, which
+ * are shared out between threads that each have an FFT of their own, rather than having FFTW split up
+ * every transform (which only pays off for very large ones). Frames start every hop samples, so with a
+ * hop shorter than the FFT they overlap (Welch's method), and the samples the window tapers away at the
+ * ends of one frame are near the middle of the next.
+ */
+class batch_fft : public gr::sync_decimator
+{
+	public:
+		batch_fft(unsigned int vector_length, unsigned int hop, const std::vector<float> &window, unsigned int threads, unsigned int batch, bool cu8) :
+			gr::sync_decimator ("batch_fft",
+				gr::io_signature::make (1, 1, cu8 ? 2 : sizeof (gr_complex)),
+				gr::io_signature::make (1, 1, sizeof (float) * vector_length),
+				hop),
+			m_vector_length(vector_length), //size of the FFT
+			m_hop(hop), //samples from the start of one frame to the next
+			m_cu8(cu8),
+			m_window(window),
+			m_in(0), //the frames being worked on
+			m_out(0),
+			m_frames(0),
+			m_generation(0), //bumped every time there's a new lot of frames
+			m_pending(0), //helper threads yet to finish their share
+			m_stop(false)
+		{
+			set_output_multiple(batch);
+			set_history(vector_length - hop + 1); //the end of the frame before, which each frame starts with
+			if (m_cu8){ //a weight for I and for Q, taking in the scaling to +-1 as well
+				m_window_cu8.resize(2 * vector_length);
+				for (unsigned int i = 0; i < vector_length; i++){
+					m_window_cu8[2*i] = m_window_cu8[2*i + 1] = window[i] / 127.5f;
+				}
+			}
+			for (unsigned int i = 0; i < threads; i++){
+				m_ffts.push_back(new gr::fft::fft_complex(vector_length, true, 1));
+			}
+			for (unsigned int i = 1; i < threads; i++){ //the scheduler's thread does the first share itself
+				m_threads.add_thread(new boost::thread(&batch_fft::Helper, this, i));
+			}
+		}
+		
+		virtual ~batch_fft()
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+			m_threads.join_all();
+			for (size_t i = 0; i < m_ffts.size(); i++){
+				delete m_ffts[i];
+			}
+		}
+		
+	private:
+		virtual int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+		{
+			const char *in = (const char *)input_items[0];
+			float *out = (float *)output_items[0];
+			if (m_ffts.size() == 1){
+				Transform(0, in, out, noutput_items);
+				return noutput_items;
+			}
+			
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				m_in = in;
+				m_out = out;
+				m_frames = noutput_items;
+				m_pending = m_ffts.size() - 1;
+				m_generation++;
+			}
+			m_wake.notify_all();
+			
+			Share(0);
+			boost::mutex::scoped_lock lock(m_mutex);
+			while (m_pending > 0){
+				m_done.wait(lock);
+			}
+			return noutput_items;
+		}
+		
+		/* Waits for frames and does its share of each lot */
+		void Helper(unsigned int index)
+		{
+			unsigned long seen = 0;
+			while (true){
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+					while (!m_stop && (m_generation == seen)){
+						m_wake.wait(lock);
+					}
+					if (m_stop){
+						return;
+					}
+					seen = m_generation;
+				}
+				
+				Share(index);
+				
+				boost::mutex::scoped_lock lock(m_mutex);
+				if (--m_pending == 0){
+					m_done.notify_one();
+				}
+			}
+		}
+		
+		/* Transforms the index'th of the even shares of the current frames */
+		void Share(unsigned int index)
+		{
+			size_t first = (size_t)m_frames * index / m_ffts.size();
+			size_t last = (size_t)m_frames * (index + 1) / m_ffts.size();
+			Transform(index, m_in + first * HopBytes(), m_out + first * m_vector_length, last - first);
+		}
+		
+		size_t HopBytes()
+		{
+			return m_hop * (m_cu8 ? 2 : sizeof(gr_complex));
+		}
+		
+		void Transform(unsigned int index, const char *in, float *out, size_t frames)
+		{
+			gr::fft::fft_complex *fft = m_ffts[index];
+			gr_complex *buffer = fft->get_inbuf();
+			const gr_complex *result = fft->get_outbuf();
+			for (size_t f = 0; f < frames; f++, in += HopBytes(), out += m_vector_length){
+				if (m_cu8){
+					Kernels::WindowCu8((float *)buffer, (const unsigned char *)in, &m_window_cu8[0], 2 * m_vector_length);
+				}
+				else {
+					const gr_complex *samples = (const gr_complex *)in;
+					for (unsigned int i = 0; i < m_vector_length; i++){
+						buffer[i] = samples[i] * m_window[i];
+					}
+				}
+				fft->execute();
+				for (unsigned int i = 0; i < m_vector_length; i++){
+					out[i] = result[i].real() * result[i].real() + result[i].imag() * result[i].imag();
+				}
+			}
+		}
+		
+		unsigned int m_vector_length;
+		unsigned int m_hop;
+		bool m_cu8;
+		std::vector<float> m_window;
+		std::vector<float> m_window_cu8; //the window for I and Q in turn, over 127.5
+		std::vector<gr::fft::fft_complex *> m_ffts; //one for each thread
+		boost::thread_group m_threads;
+		boost::mutex m_mutex;
+		boost::condition_variable m_wake;
+		boost::condition_variable m_done;
+		const char *m_in;
+		float *m_out;
+		int m_frames;
+		unsigned long m_generation;
+		unsigned int m_pending;
+		bool m_stop;
+};
+
+/* Shared pointer thing gnuradio is fond of */
+typedef boost::shared_ptr<batch_fft> batch_fft_sptr;
+batch_fft_sptr make_batch_fft(unsigned int vector_length, unsigned int hop, const std::vector<float> &window, unsigned int threads, unsigned int batch, bool cu8)
+{
+	return boost::shared_ptr<batch_fft>(new batch_fft(vector_length, hop, window, threads, batch, cu8));
+}
+
+#endif
@@ -0,0 +1,660 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Benchmarks for gr-scan. Every result is printed to stdout as one line of key=value pairs
+ * so runs can be compared between releases:
+ *
+ *	stage=NAME fft=N window=HZ ... per_sec=X p50_us=X p90_us=X p99_us=X
+ *		one detector stage on a synthetic averaged spectrum (or the sink summing an FFT into it)
+ *	stage=Detect detector=NAME fft=N ... carriers=N found=X false_alarms=X per_sec=X ...
+ *		each detector finding the signals in the same spectra (found and false_alarms are per spectrum)
+ *	check=GetBands fft=N window=HZ max_error_db=X tolerance_db=X
+ *		the running sum smoother against the original O(N*W) one (the benchmark exits with 1 if
+ *		any error is over the tolerance)
+ *	chain fft=N ... threads=N batch=N cu8=0|1 watch=0|1 samples_per_sec=X spectra_per_sec=X hops_per_sec=X
+ *		the whole flowgraph replaying synthetic IQ over a short sweep (as 8 bit IQ if cu8=1, or
+ *		just measuring the carriers as watched channels if watch=1)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <argp.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include "topblock.hpp"
+
+/* Seconds on a clock that doesn't jump */
+static double Monotonic()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parses a comma separated list of numbers */
+static std::vector<double> ParseList(const char *arg)
+{
+	std::vector<double> list;
+	const char *p = arg;
+	while (*p){
+		char *end;
+		list.push_back(strtod(p, &end));
+		if ((end == p) || ((*end != ',') && (*end != 0))){
+			fprintf(stderr, "[-] Bad list: %s\n", arg);
+			exit(1);
+		}
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return list;
+}
+
+/* Largest difference (in dB) allowed between the smoother and the reference, well above float rounding */
+static const double GetBandsTolerance = 0.01;
+
+/* A carrier in the synthetic spectrum */
+struct Carrier {
+	double freq; //Hz
+	double power; //dB above the noise
+	double width; //Hz
+};
+
+class BenchArguments
+{
+	public:
+		BenchArguments(int argc, char **argv) :
+			sample_rate(2000000.0),
+			iterations(200),
+			avg_size(100),
+			steps(8),
+			fft_threads(1),
+			fft_batch(1),
+			cu8(false),
+			watch(false),
+			tune_time(0.0)
+		{
+			fft_sizes = ParseList("256,1024,4096,16384,65536");
+			windows = ParseList("10,25,100");
+			argp_parse (&argp_i, argc, argv, 0, 0, this);
+			
+			if (carriers.empty()){ //a few broadcast FM stations
+				Carrier c = {88500000.0, 20.0, 150000.0};
+				carriers.push_back(c);
+				c.freq = 89100000.0;
+				c.power = 10.0;
+				carriers.push_back(c);
+				c.freq = 90300000.0;
+				c.power = 30.0;
+				carriers.push_back(c);
+			}
+		}
+		
+		double sample_rate;
+		unsigned int iterations;
+		unsigned int avg_size;
+		unsigned int steps;
+		unsigned int fft_threads;
+		unsigned int fft_batch;
+		bool cu8;
+		bool watch;
+		double tune_time; //seconds
+		std::vector<double> fft_sizes;
+		std::vector<double> windows; //fine windows in Hz, the coarse one is 8 times wider like gr-scan's default
+		std::vector<Carrier> carriers;
+	
+	private:
+		static error_t s_parse_opt(int key, char *arg, struct argp_state *state)
+		{
+			BenchArguments *arguments = (BenchArguments *)state->input;
+			return arguments->parse_opt (key, arg, state);
+		}
+		
+		error_t parse_opt (int key, char *arg, struct argp_state *state)
+		{
+			switch (key)
+			{
+				case 'r':
+					sample_rate = atof(arg) * 1000000.0; //MSamples/s
+					break;
+				case 'i':
+					iterations = atoi(arg);
+					break;
+				case 'a':
+					avg_size = atoi(arg);
+					break;
+				case 'z':
+					steps = atoi(arg);
+					break;
+				case 'j':
+					fft_threads = std::max(atoi(arg), 1);
+					break;
+				case 'b':
+					fft_batch = std::max(atoi(arg), 1);
+					break;
+				case '8':
+					cu8 = true;
+					break;
+				case 'T':
+					tune_time = atof(arg) / 1000.0; //ms
+					break;
+				case 'W':
+					watch = true;
+					break;
+				case 'n':
+					fft_sizes = ParseList(arg);
+					break;
+				case 'f':
+					windows = ParseList(arg);
+					for (unsigned int i = 0; i < windows.size(); i++){
+						windows[i] *= 1000.0; //kHz
+					}
+					break;
+				case 'c': {
+					Carrier c = {0.0, 20.0, 0.0};
+					if (sscanf(arg, "%lf:%lf:%lf", &c.freq, &c.power, &c.width) < 1){
+						argp_usage(state);
+					}
+					c.freq *= 1000000.0; //MHz
+					c.width *= 1000.0; //kHz
+					carriers.push_back(c);
+					break;
+				}
+				default:
+					return ARGP_ERR_UNKNOWN;
+			}
+			return 0;
+		}
+		
+		static argp_option options[];
+		static argp argp_i;
+};
+
+argp_option BenchArguments::options[] = {
+	{"sample-rate", 'r', "RATE", 0, "Samplerate in Msamples/s"},
+	{"iterations", 'i', "COUNT", 0, "Times to run each detector stage"},
+	{"average", 'a', "COUNT", 0, "FFTs averaged per spectrum in the chain benchmark"},
+	{"steps", 'z', "COUNT", 0, "Frequency steps swept in the chain benchmark"},
+	{"fft-threads", 'j', "COUNT", 0, "FFT threads in the chain benchmark"},
+	{"fft-batch", 'b', "COUNT", 0, "FFTs transformed at a time in the chain benchmark"},
+	{"cu8", '8', 0, 0, "Replay unsigned 8 bit IQ through the 8 bit path in the chain benchmark"},
+	{"watch", 'W', 0, 0, "Watch the carriers as channels with the Goertzel bank instead of sweeping in the chain benchmark"},
+	{"tune-time", 'T', "TIME", 0, "Milliseconds each retune takes in the chain benchmark (like a real radio's)"},
+	{"fft-sizes", 'n', "LIST", 0, "Comma separated FFT sizes"},
+	{"fine-bandwidths", 'f', "LIST", 0, "Comma separated fine window widths in kHz"},
+	{"carrier", 'c', "FREQ:POWER:WIDTH", 0, "Add a carrier at FREQ MHz, POWER dB above the noise and WIDTH kHz wide (repeatable)"},
+	{0}
+};
+argp BenchArguments::argp_i = {options, s_parse_opt, 0, "Benchmarks the gr-scan pipeline on synthetic signals"};
+
+const char *argp_program_version = VERSION " benchmarks";
+
+/* Makes up the signals the benchmarks look at: the carriers in unit power complex white noise */
+class Synthesiser
+{
+	public:
+		Synthesiser(const std::vector<Carrier> &carriers) :
+			m_carriers(carriers)
+		{
+		}
+		
+		/* IQ as a radio tuned to centre would see it (each carrier is a wobbling tone spread over its width) */
+		void GenerateIQ(gr_complex *out, size_t n, double centre, double sample_rate)
+		{
+			boost::random::normal_distribution<float> noise(0.0, std::sqrt(0.5));
+			for (size_t i = 0; i < n; i++){
+				out[i] = gr_complex(noise(m_rng), noise(m_rng));
+			}
+			
+			BOOST_FOREACH (const Carrier &c, m_carriers){
+				double offset = c.freq - centre;
+				if ((offset < -sample_rate/2.0) || (offset > sample_rate/2.0)){
+					continue; //we wouldn't hear it
+				}
+				
+				float amplitude = std::pow(10.0, c.power/20.0);
+				double phase = 0.0;
+				boost::random::uniform_real_distribution<double> wobble(-c.width/2.0, c.width/2.0);
+				double deviation = 0.0;
+				for (size_t i = 0; i < n; i++){
+					if (i % 64 == 0){
+						deviation = wobble(m_rng); //hop about within the carrier's width
+					}
+					phase += 2.0 * M_PI * (offset + deviation) / sample_rate;
+					out[i] += amplitude * gr_complex(std::cos(phase), std::sin(phase));
+				}
+			}
+		}
+		
+		/* The sum of avg_size power spectra with 0 Hz in the middle, as the sink would hand it to the analyser */
+		void GenerateSpectrum(float *out, unsigned int n, unsigned int avg_size, double centre, double sample_rate)
+		{
+			/* the average of avg_size exponentially distributed bins is close to normal */
+			boost::random::normal_distribution<float> noise(1.0, 1.0 / std::sqrt((float)avg_size));
+			std::vector<float> power(n);
+			for (unsigned int i = 0; i < n; i++){
+				power[i] = std::max(noise(m_rng), 0.01f);
+			}
+			
+			double samplewidth = sample_rate / n;
+			BOOST_FOREACH (const Carrier &c, m_carriers){
+				double low = c.freq - std::max(c.width, samplewidth)/2.0 - (centre - sample_rate/2.0);
+				double high = low + std::max(c.width, samplewidth);
+				for (long i = std::max(0L, (long)(low/samplewidth)); (i < (long)n) && (i * samplewidth < high); i++){
+					power[i] += std::pow(10.0, c.power/10.0);
+				}
+			}
+			
+			for (unsigned int i = 0; i < n; i++){
+				out[i] = power[i] * avg_size;
+			}
+		}
+	
+	private:
+		std::vector<Carrier> m_carriers;
+		boost::random::mt19937 m_rng;
+};
+
+/* The original O(N*W) window smoother, kept to check the running sum version against */
+static void ReferenceGetBands(float *powers, float *bands, unsigned int bandwidth, unsigned int vector_length, double sample_rate)
+{
+	double samplewidth = sample_rate/(double)vector_length;
+	unsigned int bandwidth_samples = bandwidth/samplewidth;
+	for (unsigned int i = 0; i < vector_length; i++){
+		bands[i] = 0.0;
+	}
+	
+	for (unsigned int i = 0; i < vector_length; i++){
+		if ((i >= bandwidth_samples/2) && (i < vector_length + bandwidth_samples/2 - bandwidth_samples)){
+			for (unsigned int j = 0; j < bandwidth_samples; j++){
+				bands[i + j - bandwidth_samples/2] += powers[i] / (float)bandwidth_samples;
+			}
+		}
+	}
+}
+
+/* Collects how long something took each time and reports it */
+class Timings
+{
+	public:
+		void Add(double seconds)
+		{
+			m_times.push_back(seconds);
+		}
+		
+		void Print(const char *what)
+		{
+			std::sort(m_times.begin(), m_times.end());
+			double total = 0.0;
+			BOOST_FOREACH (double t, m_times){
+				total += t;
+			}
+			printf("%s per_sec=%.1f p50_us=%.2f p90_us=%.2f p99_us=%.2f\n",
+				what, m_times.size() / total, Percentile(0.5) * 1e6, Percentile(0.9) * 1e6, Percentile(0.99) * 1e6);
+			fflush(stdout);
+		}
+	
+	private:
+		double Percentile(double p)
+		{
+			return m_times[std::min(m_times.size() - 1, (size_t)(p * m_times.size()))];
+		}
+		
+		std::vector<double> m_times;
+};
+
+/* Keeps the scanner's own chatter off the terminal while we time it */
+class Silence
+{
+	public:
+		Silence(bool out) :
+			m_out(out),
+			m_saved_out(-1),
+			m_saved_err(-1)
+		{
+			fflush(stdout);
+			fflush(stderr);
+			int null = open("/dev/null", O_WRONLY);
+			m_saved_err = dup(2);
+			dup2(null, 2);
+			if (m_out){
+				m_saved_out = dup(1);
+				dup2(null, 1);
+			}
+			close(null);
+		}
+		
+		~Silence()
+		{
+			fflush(stdout);
+			fflush(stderr);
+			dup2(m_saved_err, 2);
+			close(m_saved_err);
+			if (m_out){
+				dup2(m_saved_out, 1);
+				close(m_saved_out);
+			}
+		}
+	
+	private:
+		bool m_out;
+		int m_saved_out;
+		int m_saved_err;
+};
+
+static bool BenchStages(BenchArguments &args, Synthesiser &synth, unsigned int n, double fine)
+{
+	double coarse = fine * 8.0;
+	double centre = 89500000.0;
+	FILE *null = fopen("/dev/null", "w");
+	
+	std::vector<float> buffer(n), fft(n), bands0(n), bands1(n), bands2(n), check(n);
+	synth.GenerateSpectrum(&buffer[0], n, args.avg_size, centre, args.sample_rate);
+	
+	SpectrumAnalyser analyser(n, args.sample_rate, fine, coarse, args.avg_size, 50000.0, 3.0, true, 0.0, centre, centre, 0.0, 0, 0.0, 1);
+	analyser.SetOutput(null);
+	
+	char what[256];
+	Timings accumulate, rearrange, bands, reference, print, trysignal;
+	{
+		Silence quiet(false);
+		for (unsigned int i = 0; i < args.iterations; i++){
+			double start = Monotonic();
+			analyser.Rearrange(&buffer[0], &bands0[0], args.avg_size);
+			double mid = Monotonic();
+			analyser.GetBands(&bands0[0], &bands1[0], &bands2[0], n);
+			double end = Monotonic();
+			analyser.PrintSignals(centre - args.sample_rate/2.0, &bands0[0], &bands1[0], &bands2[0], n, centre, Now());
+			print.Add(Monotonic() - end);
+			rearrange.Add(mid - start);
+			bands.Add(end - mid);
+			
+			start = Monotonic();
+			Kernels::AccumulateShifted(&fft[0], &buffer[0], n);
+			accumulate.Add(Monotonic() - start);
+		}
+		
+		/* the reference is slow, so only run it a few times */
+		for (unsigned int i = 0; i < std::min(args.iterations, 5u); i++){
+			double start = Monotonic();
+			ReferenceGetBands(&bands0[0], &check[0], coarse, n, args.sample_rate);
+			reference.Add(Monotonic() - start);
+		}
+	}
+	
+	snprintf(what, sizeof(what), "stage=Accumulate fft=%u kernels=%s", n, Kernels::Name());
+	accumulate.Print(what);
+	snprintf(what, sizeof(what), "stage=Rearrange fft=%u", n);
+	rearrange.Print(what);
+	snprintf(what, sizeof(what), "stage=GetBands fft=%u window=%.0f coarse=%.0f", n, fine, coarse);
+	bands.Print(what);
+	snprintf(what, sizeof(what), "stage=GetBandsReference fft=%u window=%.0f", n, coarse);
+	reference.Print(what);
+	snprintf(what, sizeof(what), "stage=PrintSignals fft=%u window=%.0f coarse=%.0f", n, fine, coarse);
+	print.Print(what);
+	
+	/* both windows should match the old smoother */
+	double error = 0.0;
+	ReferenceGetBands(&bands0[0], &check[0], fine, n, args.sample_rate);
+	for (unsigned int i = 0; i < n; i++){
+		error = std::max(error, (double)std::fabs(check[i] - bands1[i]));
+	}
+	ReferenceGetBands(&bands0[0], &check[0], coarse, n, args.sample_rate);
+	for (unsigned int i = 0; i < n; i++){
+		error = std::max(error, (double)std::fabs(check[i] - bands2[i]));
+	}
+	printf("check=GetBands fft=%u window=%.0f max_error_db=%g tolerance_db=%g\n", n, fine, error, GetBandsTolerance);
+	if (error > GetBandsTolerance){
+		fprintf(stderr, "[-] GetBands differs from the reference by %g dB (fft=%u window=%.0f)\n", error, n, fine);
+	}
+	
+	/* TrySignal against a table that already holds a wideband sweep's worth of signals */
+	SpectrumAnalyser table(n, args.sample_rate, fine, coarse, args.avg_size, 50000.0, 3.0, true, 0.0, centre, centre, 0.0, 0, 0.0, 1);
+	for (unsigned int i = 0; i < 1000; i++){
+		double f = 100000000.0 + i * 1000000.0;
+		table.TrySignal(f - 1000.0, f + 1000.0, 0.0, -30.0, 0.0);
+	}
+	boost::random::mt19937 rng;
+	boost::random::uniform_real_distribution<double> where(100000000.0, 1100000000.0);
+	for (unsigned int i = 0; i < args.iterations; i++){
+		double f = where(rng);
+		double start = Monotonic();
+		table.TrySignal(f - 1000.0, f + 1000.0, 0.0, -30.0, 0.0);
+		trysignal.Add(Monotonic() - start);
+	}
+	snprintf(what, sizeof(what), "stage=TrySignal signals=1000");
+	trysignal.Print(what);
+	
+	fclose(null);
+	return error <= GetBandsTolerance;
+}
+
+/* Whether a found signal overlaps a carrier (give or take a fine window, as the edges are only found to within that) */
+static bool Overlaps(const Signal &signal, const Carrier &carrier, double slack)
+{
+	double half = carrier.width/2.0 + slack;
+	return (signal.min <= carrier.freq + half) && (signal.max >= carrier.freq - half);
+}
+
+/* Every detector on the same spectra: how long it takes to find the signals in one, and how many of the carriers it finds */
+static void BenchDetectors(BenchArguments &args, Synthesiser &synth, unsigned int n, double fine)
+{
+	static const char *detectors[] = {"window", "ca-cfar", "os-cfar"};
+	double coarse = fine * 8.0;
+	double centre = 89500000.0;
+	double start = centre - args.sample_rate/2.0;
+	unsigned int spectra = std::min(args.iterations, 20u); //a fresh analyser for each, so each is judged on its own
+	FILE *null = fopen("/dev/null", "w");
+	
+	/* the carriers wholly in view, and not so near the centre that TrySignal would throw them out */
+	std::vector<Carrier> carriers;
+	BOOST_FOREACH (const Carrier &c, args.carriers){
+		double offset = std::fabs(c.freq - centre);
+		if ((offset + c.width/2.0 < args.sample_rate/2.0) && (offset >= 50000.0)){
+			carriers.push_back(c);
+		}
+	}
+	
+	std::vector<std::vector<float> > buffers(spectra, std::vector<float>(n));
+	for (unsigned int i = 0; i < spectra; i++){
+		synth.GenerateSpectrum(&buffers[i][0], n, args.avg_size, centre, args.sample_rate);
+	}
+	std::vector<float> bands0(n), bands1(n), bands2(n);
+	
+	char what[256];
+	for (unsigned int d = 0; d < sizeof(detectors)/sizeof(detectors[0]); d++){
+		Timings timings;
+		unsigned int hits = 0;
+		unsigned int false_alarms = 0;
+		for (unsigned int i = 0; i < args.iterations; i++){
+			unsigned int s = i % spectra;
+			SpectrumAnalyser analyser(n, args.sample_rate, fine, coarse, args.avg_size, 50000.0, 3.0, true, 0.0, centre, centre, 0.0, 0, 0.0, 1);
+			analyser.SetDetector(detectors[d]);
+			analyser.SetOutput(null);
+			analyser.Rearrange(&buffers[s][0], &bands0[0], args.avg_size);
+			analyser.GetBands(&bands0[0], &bands1[0], &bands2[0], n);
+			
+			double begin = Monotonic();
+			analyser.PrintSignals(start, &bands0[0], &bands1[0], &bands2[0], n, centre, Now());
+			timings.Add(Monotonic() - begin);
+			
+			if (i >= spectra){
+				continue; //counted this one already
+			}
+			std::vector<Signal> found;
+			analyser.Signals(found);
+			BOOST_FOREACH (const Carrier &c, carriers){
+				bool hit = false;
+				BOOST_FOREACH (const Signal &signal, found){
+					hit = hit || Overlaps(signal, c, fine);
+				}
+				hits += hit;
+			}
+			BOOST_FOREACH (const Signal &signal, found){
+				bool real = false;
+				BOOST_FOREACH (const Carrier &c, args.carriers){
+					real = real || Overlaps(signal, c, fine);
+				}
+				false_alarms += !real;
+			}
+		}
+		
+		snprintf(what, sizeof(what), "stage=Detect detector=%s fft=%u window=%.0f coarse=%.0f carriers=%lu found=%.2f false_alarms=%.2f", detectors[d], n, fine, coarse,
+			(unsigned long)carriers.size(), hits / (double)spectra, false_alarms / (double)spectra);
+		timings.Print(what);
+	}
+	
+	fclose(null);
+}
+
+static void BenchChain(BenchArguments &args, Synthesiser &synth, unsigned int n, double fine)
+{
+	double step = args.sample_rate / 4.0;
+	double start = 88000000.0;
+	size_t samples = std::max((size_t)n * 4, (size_t)262144); //per capture, the replay loops it
+	
+	/* the steps, or the windows of a watchlist of the carriers */
+	char directory[] = "/tmp/gr-scan-bench.XXXXXX";
+	if (!mkdtemp(directory)){
+		perror("mkdtemp");
+		exit(1);
+	}
+	std::string watchlist;
+	std::vector<double> centres;
+	if (args.watch){
+		watchlist = std::string(directory) + "/watchlist";
+		FILE *channels = fopen(watchlist.c_str(), "w");
+		Watchlist grouped;
+		BOOST_FOREACH (const Carrier &c, args.carriers){
+			fprintf(channels, "%f %f\n", c.freq / 1000000.0, c.width / 1000.0);
+			grouped.AddChannel(c.freq, c.width);
+		}
+		fclose(channels);
+		grouped.Group(args.sample_rate, 50000.0);
+		centres = grouped.Centres();
+	}
+	else {
+		for (unsigned int s = 0; s < args.steps; s++){
+			centres.push_back(start + s * step);
+		}
+	}
+	
+	/* write a capture for each and an index for them */
+	std::string index = std::string(directory) + "/index";
+	FILE *list = fopen(index.c_str(), "w");
+	fprintf(list, "tune-time %f\n", args.tune_time);
+	std::vector<gr_complex> iq(samples);
+	std::vector<unsigned char> bytes(args.cu8 ? samples * 2 : 0);
+	std::vector<std::string> files;
+	for (unsigned int s = 0; s < centres.size(); s++){
+		char name[64];
+		snprintf(name, sizeof(name), args.cu8 ? "step%u.cu8" : "step%u.cf32", s);
+		files.push_back(std::string(directory) + "/" + name);
+		synth.GenerateIQ(&iq[0], samples, centres[s], args.sample_rate);
+		
+		FILE *capture = fopen(files.back().c_str(), "wb");
+		if (args.cu8){ //scaled so the biggest sample just fits, like a dongle with its gain set right
+			float peak = 0.0f;
+			for (size_t i = 0; i < samples; i++){
+				peak = std::max(peak, std::max(std::fabs(iq[i].real()), std::fabs(iq[i].imag())));
+			}
+			float scale = 127.0f / peak;
+			for (size_t i = 0; i < samples; i++){
+				bytes[2*i] = (unsigned char)std::floor(iq[i].real() * scale + 128.0f);
+				bytes[2*i + 1] = (unsigned char)std::floor(iq[i].imag() * scale + 128.0f);
+			}
+			fwrite(&bytes[0], 2, samples, capture);
+		}
+		else {
+			fwrite(&iq[0], sizeof(gr_complex), samples, capture);
+		}
+		fclose(capture);
+		fprintf(list, "%f %s\n", centres[s], name);
+	}
+	fclose(list);
+	
+	double elapsed;
+	{
+		TopBlock::Settings settings;
+		settings.centre_freq_1 = start;
+		settings.centre_freq_2 = start + (args.steps - 1) * step + step / 2.0;
+		settings.sample_rate = args.sample_rate;
+		settings.fft_width = args.sample_rate / n;
+		settings.bandwidth1 = fine;
+		settings.bandwidth2 = fine * 8.0;
+		settings.step = step;
+		settings.avg_size = args.avg_size;
+		settings.replays.push_back(index);
+		settings.max_signals = 0;
+		settings.fft_threads = args.fft_threads;
+		settings.fft_batch = args.fft_batch;
+		settings.cu8 = args.cu8;
+		settings.watchlist = watchlist;
+		TopBlock top_block(settings);
+		Silence quiet(true);
+		double begin = Monotonic();
+		top_block.Run();
+		elapsed = Monotonic() - begin;
+	}
+	
+	unsigned int steps = centres.size();
+	double total = (double)steps * args.avg_size * n;
+	printf("chain fft=%u window=%.0f average=%u steps=%u threads=%u batch=%u cu8=%d watch=%d samples_per_sec=%.0f spectra_per_sec=%.2f hops_per_sec=%.2f\n",
+		n, fine, args.avg_size, steps, args.fft_threads, args.fft_batch, (int)args.cu8, (int)args.watch, total / elapsed, steps / elapsed, (steps - 1) / elapsed);
+	fflush(stdout);
+	
+	BOOST_FOREACH (const std::string &file, files){
+		unlink(file.c_str());
+	}
+	unlink(index.c_str());
+	if (!watchlist.empty()){
+		unlink(watchlist.c_str());
+	}
+	rmdir(directory);
+}
+
+int main(int argc, char **argv)
+{
+	BenchArguments args(argc, argv);
+	Synthesiser synth(args.carriers);
+	bool passed = true;
+	
+	BOOST_FOREACH (double size, args.fft_sizes){
+		BOOST_FOREACH (double fine, args.windows){
+			passed = BenchStages(args, synth, size, fine) && passed;
+			BenchDetectors(args, synth, size, fine);
+		}
+	}
+	
+	BOOST_FOREACH (double size, args.fft_sizes){
+		BenchChain(args, synth, size, args.windows[0]);
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef CONTROL_HPP
+#define CONTROL_HPP
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "unix_socket.hpp"
+
+/*
+ * Takes commands on a UNIX socket while we sweep, so a long running scan can be retasked without
+ * rebuilding the flowgraph. Each line sent is a command, answered with "ok" or "error: ..." on a line:
+ *
+ *	range START END [STEP]	sweep from START to END MHz (in steps of STEP MHz) from the next pass
+ *	threshold POWER		report signals POWER dB above the coarse window from the next spectrum
+ *	average COUNT		average COUNT FFTs per spectrum from the next hop
+ *	time TIME		listen for TIME seconds on each frequency from the next hop
+ *	gain GAIN		set every device's gain to GAIN dB at its next hop
+ *	subscribe		send every signal found, changed or lost to this connection too
+ *	unsubscribe		stop sending them
+ *	status			list the settings, as the commands that would set them
+ *
+ * The sinks and the detection worker each look for changes in their own time (see Changed), so
+ * nothing in the flowgraph waits on the socket. A subscriber that doesn't keep up is hung up on
+ * rather than being allowed to hold up detection.
+ */
+class Control
+{
+	public:
+		struct Settings {
+			double centre_freq_1; //first step (Hz)
+			double centre_freq_2; //last step
+			double step;
+			double threshold; //dB
+			unsigned int avg_size; //FFTs averaged in each spectrum
+			double ptime; //seconds to listen on each frequency
+			double gain; //dB, or NaN to leave the devices as they were set up
+		};
+		
+		Control(const Settings &settings) :
+			m_settings(settings),
+			m_version(0), //changes made so far
+			m_new_range(false), //whether the range has changed since the sweep last took it
+			m_max_span(0.0), //widest range we can change to (0 for no limit)
+			m_listener(-1),
+			m_stop(false),
+			m_started(false)
+		{
+		}
+		
+		~Control()
+		{
+			Stop();
+		}
+		
+		/* Starts taking commands on the UNIX socket path */
+		void Start(const std::string &path)
+		{
+			m_socket = path;
+			m_listener = ListenUnix(m_socket, "control", 0600); //the commands change what's swept, so only our user may connect
+			m_started = true;
+			m_thread = boost::thread(&Control::Run, this);
+			fprintf(stderr, "[*] Taking commands on %s\n", m_socket.c_str());
+		}
+		
+		/* Hangs up on everyone and takes the socket away */
+		void Stop()
+		{
+			if (!m_started){
+				return;
+			}
+			m_stop.store(true);
+			m_thread.join();
+			
+			boost::mutex::scoped_lock lock(m_mutex);
+			for (size_t i = 0; i < m_clients.size(); i++){
+				close(m_clients[i].fd);
+			}
+			m_clients.clear();
+			close(m_listener);
+			unlink(m_socket.c_str());
+			m_started = false;
+		}
+		
+		/* Limits how wide a range can be asked for (the stitched spectrum can't grow once it's set up) */
+		void SetMaxSpan(double span)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_max_span = span;
+		}
+		
+		/* If anything's changed since version, copies out the settings and brings version up to date (from any thread) */
+		bool Changed(unsigned int &version, Settings &settings)
+		{
+			if (m_version.load(boost::memory_order_acquire) == version){ //the usual case, without taking the lock
+				return false;
+			}
+			boost::mutex::scoped_lock lock(m_mutex);
+			settings = m_settings;
+			version = m_version.load(boost::memory_order_relaxed);
+			return true;
+		}
+		
+		/* If the range has changed, gives the new one (just once, to whichever sink ends the pass) */
+		bool TakeRange(double &centre_freq_1, double &centre_freq_2, double &step)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (!m_new_range){
+				return false;
+			}
+			centre_freq_1 = m_settings.centre_freq_1;
+			centre_freq_2 = m_settings.centre_freq_2;
+			step = m_settings.step;
+			m_new_range = false;
+			return true;
+		}
+		
+		/* Sends a line to every subscriber (from the detection worker) */
+		void Publish(const std::string &line)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			for (size_t i = 0; i < m_clients.size(); i++){
+				if (m_clients[i].subscribed && !Send(m_clients[i].fd, line)){
+					shutdown(m_clients[i].fd, SHUT_RDWR); //Run sees it's gone, and tidies up
+				}
+			}
+		}
+		
+	private:
+		struct Client {
+			int fd;
+			std::string input; //what's been read of a command so far
+			bool subscribed;
+		};
+		
+		void Run()
+		{
+			std::vector<struct pollfd> fds;
+			while (!m_stop.load()){
+				fds.clear();
+				struct pollfd listener = {m_listener, POLLIN, 0};
+				fds.push_back(listener);
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+					for (size_t i = 0; i < m_clients.size(); i++){
+						struct pollfd client = {m_clients[i].fd, POLLIN, 0};
+						fds.push_back(client);
+					}
+				}
+				
+				if (poll(&fds[0], fds.size(), 200) <= 0){
+					continue;
+				}
+				if (fds[0].revents & POLLIN){
+					Accept();
+				}
+				for (size_t i = 1; i < fds.size(); i++){
+					if (fds[i].revents){
+						Read(fds[i].fd);
+					}
+				}
+			}
+		}
+		
+		void Accept()
+		{
+			int fd = accept(m_listener, 0, 0);
+			if (fd < 0){
+				return;
+			}
+			Client client = {fd, "", false};
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_clients.push_back(client);
+		}
+		
+		/* Reads what a client has sent, answering every complete line, and hangs up if it has */
+		void Read(int fd)
+		{
+			char buffer[1024];
+			ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+			
+			boost::mutex::scoped_lock lock(m_mutex);
+			size_t i = 0;
+			while ((i < m_clients.size()) && (m_clients[i].fd != fd)){
+				i++;
+			}
+			if (i == m_clients.size()){
+				return;
+			}
+			
+			Client &client = m_clients[i];
+			if (got > 0){
+				client.input.append(buffer, got);
+				size_t end;
+				while ((end = client.input.find('\n')) != std::string::npos){
+					std::string line = client.input.substr(0, end);
+					client.input.erase(0, end + 1);
+					Send(fd, Command(client, line));
+				}
+			}
+			if ((got <= 0) || (client.input.size() > sizeof(buffer))){ //gone, or not sending commands
+				close(fd);
+				m_clients.erase(m_clients.begin() + i);
+			}
+		}
+		
+		/* Carries out a command from client, returning the answer (with m_mutex held) */
+		std::string Command(Client &client, const std::string &line)
+		{
+			char word[16];
+			double a, b, c;
+			int n = sscanf(line.c_str(), "%15s %lf %lf %lf", word, &a, &b, &c);
+			std::string command = (n >= 1) ? word : "";
+			Settings settings = m_settings;
+			
+			if (command.empty()){
+				return "";
+			}
+			else if ((command == "range") && ((n == 3) || (n == 4))){
+				settings.centre_freq_1 = a * 1000000.0; //MHz
+				settings.centre_freq_2 = b * 1000000.0;
+				if (n == 4){
+					settings.step = c * 1000000.0;
+				}
+				if (!(settings.step > 0.0) || !(settings.centre_freq_2 >= settings.centre_freq_1)){
+					return "error: the range must go upwards in positive steps\n";
+				}
+				if ((m_max_span > 0.0) && (settings.centre_freq_2 - settings.centre_freq_1 > m_max_span)){
+					return Format("error: the range can be at most %f MHz wide when stitching\n", m_max_span / 1000000.0);
+				}
+				m_new_range = true;
+			}
+			else if ((command == "threshold") && (n == 2)){
+				settings.threshold = a;
+			}
+			else if ((command == "average") && (n == 2) && (a >= 1.0)){
+				settings.avg_size = a;
+			}
+			else if ((command == "time") && (n == 2)){
+				settings.ptime = a;
+			}
+			else if ((command == "gain") && (n == 2)){
+				settings.gain = a;
+			}
+			else if ((command == "subscribe") && (n == 1)){
+				client.subscribed = true;
+				return "ok\n";
+			}
+			else if ((command == "unsubscribe") && (n == 1)){
+				client.subscribed = false;
+				return "ok\n";
+			}
+			else if ((command == "status") && (n == 1)){
+				return Format("range %f %f %f\n", m_settings.centre_freq_1 / 1000000.0, m_settings.centre_freq_2 / 1000000.0, m_settings.step / 1000000.0) +
+					Format("threshold %f\naverage %u\ntime %f\n", m_settings.threshold, m_settings.avg_size, m_settings.ptime) +
+					((m_settings.gain == m_settings.gain) ? Format("gain %f\n", m_settings.gain) : "") + "ok\n";
+			}
+			else {
+				return "error: can't understand " + line + "\n";
+			}
+			
+			m_settings = settings;
+			m_version.fetch_add(1, boost::memory_order_release);
+			fprintf(stderr, "[*] Command: %s\n", line.c_str());
+			return "ok\n";
+		}
+		
+		/* Sends as much of text as the client will take without waiting, returning false if that wasn't all of it */
+		bool Send(int fd, const std::string &text)
+		{
+			for (size_t done = 0; done < text.size(); ){
+				ssize_t wrote = send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL | MSG_DONTWAIT);
+				if (wrote <= 0){
+					return false;
+				}
+				done += wrote;
+			}
+			return true;
+		}
+		
+		static std::string Format(const char *format, ...)
+		{
+			char line[256];
+			va_list args;
+			va_start(args, format);
+			vsnprintf(line, sizeof(line), format, args);
+			va_end(args);
+			return line;
+		}
+		
+		Settings m_settings;
+		boost::atomic<unsigned int> m_version;
+		bool m_new_range;
+		double m_max_span;
+		std::string m_socket;
+		int m_listener;
+		boost::atomic<bool> m_stop;
+		bool m_started;
+		boost::mutex m_mutex; //guards the settings and the clients
+		std::vector<Client> m_clients;
+		boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<Control> control_sptr;
+
+#endif
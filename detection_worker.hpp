@@ -0,0 +1,355 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef DETECTION_WORKER_HPP
+#define DETECTION_WORKER_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "control.hpp"
+#include "spectrum_analyser.hpp"
+#include "spectrum_queue.hpp"
+
+/*
+ * Runs detection and reporting on its own thread, so a slow terminal never holds up the flowgraph. It's shared by the sinks of
+ * every device, each with a queue of its own, so handing a spectrum over never takes a lock unless the queue's full.
+ */
+class DetectionWorker
+{
+	public:
+		DetectionWorker(unsigned int vector_length, size_t queue_size, unsigned int devices, double bandwidth0, double bandwidth1, double bandwidth2,
+				unsigned int avg_size, double spread, double threshold, bool linear, float log_offset, double centre_freq_1, double centre_freq_2,
+				double stitch, size_t max_signals, double max_age, unsigned int passes) :
+			m_vector_length(vector_length),
+			m_next(0), //queue to look at first
+			m_waiting(0), //sinks waiting for room in their queues
+			m_analyser(vector_length, bandwidth0, bandwidth1, bandwidth2, avg_size, spread, threshold, linear, log_offset, centre_freq_1, centre_freq_2, stitch,
+				max_signals, max_age, passes),
+			m_checker(vector_length, bandwidth0, bandwidth1, bandwidth2, avg_size, spread, threshold, linear, log_offset, centre_freq_1, centre_freq_2, 0.0,
+				1, 0.0, 1), //the same settings, for deciding when a spectrum's been averaged enough
+			m_version(0), //of the control's settings, as the analyser and checker have them
+			m_settle_count(0), //fewest FFTs the checker could say are enough
+			m_started(0.0),
+			m_reported(false), //whether the first spectrum's been reported
+			m_finishing(false)
+		{
+			for (unsigned int i = 0; i < devices; i++){
+				m_queues.push_back(boost::shared_ptr<SpectrumQueue>(new SpectrumQueue(vector_length, queue_size)));
+			}
+			m_settle_count.store(m_checker.SettleCount());
+			m_thread = boost::thread(&DetectionWorker::Run, this);
+		}
+		
+		~DetectionWorker()
+		{
+			Finish();
+		}
+		
+		/* Queues a summed spectrum from device for detection, and to be checked in check if that's set (only waits if detection has fallen a whole queue behind) */
+		void Submit(unsigned int device, const float *buffer, unsigned int count, double centre, double timestamp, uint64_t discarded, SettleCheck *check)
+		{
+			SpectrumQueue &queue = *m_queues[device];
+			Spectrum *spectrum = Space(queue);
+			
+			memcpy(spectrum->buffer, buffer, m_vector_length * sizeof(float));
+			spectrum->count = count;
+			spectrum->centre = centre;
+			spectrum->timestamp = timestamp;
+			spectrum->discarded = discarded;
+			spectrum->check = check;
+			spectrum->partial = false;
+			spectrum->end_of_sweep = false;
+			if (check){
+				check->state.store(SettleCheck::ASKED, boost::memory_order_relaxed);
+			}
+			queue.Push();
+			
+			if ((m_started > 0.0) && !m_reported.exchange(true)){
+				fprintf(stderr, "[*] First spectrum %.3f seconds after starting\n", timestamp - m_started);
+			}
+		}
+		
+		/*
+		 * Queues the end of a pass over the frequency range (from the device that finished it last), so detection knows everything
+		 * every device submitted before it makes up one sweep, and everything after covers next_start to next_end (NaN if the range
+		 * is unchanged)
+		 */
+		void EndSweep(unsigned int device, double timestamp, double next_start, double next_end)
+		{
+			SpectrumQueue &queue = *m_queues[device];
+			Spectrum *spectrum = Space(queue);
+			
+			spectrum->timestamp = timestamp;
+			spectrum->check = 0;
+			spectrum->end_of_sweep = true;
+			spectrum->next_start = next_start;
+			spectrum->next_end = next_end;
+			spectrum->pushed.resize(m_queues.size());
+			for (size_t i = 0; i < m_queues.size(); i++){ //the other devices are idle, waiting for the next pass, so these won't grow before we push
+				spectrum->pushed[i] = m_queues[i]->Pushed();
+			}
+			queue.Push();
+		}
+		
+		/* Processes whatever is still queued, then stops the thread */
+		void Finish()
+		{
+			m_finishing.store(true);
+			if (m_thread.joinable()){
+				m_thread.join();
+			}
+		}
+		
+		/*
+		 * Queues device's partial sum of count FFTs to see whether it's enough to decide what's in it (see SpectrumAnalyser::Settled),
+		 * with the answer going in check. Never waits: if the queue's over half full, returns false without asking, so the spectra
+		 * detection's still to report don't have to wait behind checks.
+		 */
+		bool Check(unsigned int device, const float *buffer, unsigned int count, SettleCheck *check)
+		{
+			SpectrumQueue &queue = *m_queues[device];
+			Spectrum *spectrum = (queue.Size() * 2 < queue.Capacity()) ? queue.Back() : 0;
+			if (!spectrum){
+				return false;
+			}
+			
+			memcpy(spectrum->buffer, buffer, m_vector_length * sizeof(float));
+			spectrum->count = count;
+			spectrum->check = check;
+			spectrum->partial = true;
+			spectrum->end_of_sweep = false;
+			check->state.store(SettleCheck::ASKED, boost::memory_order_relaxed);
+			queue.Push();
+			return true;
+		}
+		
+		/* Where found signals get printed (only to be changed before anything is submitted) */
+		void SetOutput(FILE *output)
+		{
+			m_analyser.SetOutput(output);
+		}
+		
+		/* Which detector decides what's a signal (also only to be changed before anything is submitted) */
+		void SetDetector(const std::string &name)
+		{
+			m_analyser.SetDetector(name);
+			m_checker.SetDetector(name);
+		}
+		
+		/* How many independent FFTs each one's worth (also only to be changed before anything is submitted) */
+		void SetFrameWorth(double worth)
+		{
+			m_analyser.SetFrameWorth(worth);
+			m_checker.SetFrameWorth(worth);
+			m_settle_count.store(m_checker.SettleCount());
+		}
+		
+		/* The fewest FFTs worth asking Check about, as fewer can't be enough for the threshold (from any thread) */
+		unsigned int SettleCount()
+		{
+			return m_settle_count.load(boost::memory_order_relaxed);
+		}
+		
+		/* Where changes to the threshold come from, and found signals get sent to (also only to be changed before anything is submitted) */
+		void SetControl(control_sptr control)
+		{
+			m_control = control;
+			m_analyser.SetControl(control);
+		}
+		
+		/* The channels to measure, if we're watching some rather than looking everywhere (also only to be changed before anything is submitted) */
+		void SetWatchlist(watchlist_sptr watchlist)
+		{
+			m_analyser.SetWatchlist(watchlist);
+		}
+		
+		/* Where every averaged spectrum gets logged (also only to be changed before anything is submitted) */
+		void SetLog(spectrum_log_writer_sptr log)
+		{
+			m_analyser.SetLog(log);
+		}
+		
+		/* Reports how long after started the first spectrum is submitted (0 doesn't) */
+		void SetStarted(double started)
+		{
+			m_started = started;
+		}
+		
+		/* Spectra waiting for detection, from all the devices (for the metrics, from any thread) */
+		size_t QueueDepth()
+		{
+			size_t depth = 0;
+			for (size_t i = 0; i < m_queues.size(); i++){
+				depth += m_queues[i]->Size();
+			}
+			return depth;
+		}
+		
+		size_t QueueCapacity()
+		{
+			size_t capacity = 0;
+			for (size_t i = 0; i < m_queues.size(); i++){
+				capacity += m_queues[i]->Capacity();
+			}
+			return capacity;
+		}
+		
+		/* The signals found (only once Finish() has returned) */
+		void Signals(std::vector<Signal> &signals)
+		{
+			m_analyser.Signals(signals);
+		}
+		
+	private:
+		/* The queue's next free slot, waiting for detection to free one if it's full */
+		Spectrum *Space(SpectrumQueue &queue)
+		{
+			Spectrum *spectrum = queue.Back();
+			if (spectrum){ //the usual case, which doesn't lock anything
+				return spectrum;
+			}
+			
+			boost::mutex::scoped_lock lock(m_space_mutex);
+			m_waiting.fetch_add(1);
+			boost::atomic_thread_fence(boost::memory_order_seq_cst); //so either detection sees we're waiting, or we see the slot it freed (see Freed)
+			while (!(spectrum = queue.Back())){
+				m_space.wait(lock);
+			}
+			m_waiting.fetch_sub(1);
+			return spectrum;
+		}
+		
+		/* Wakes any sinks waiting in Space, after a slot's been popped */
+		void Freed()
+		{
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+			if (m_waiting.load(boost::memory_order_relaxed) > 0){
+				boost::mutex::scoped_lock lock(m_space_mutex);
+				m_space.notify_all();
+			}
+		}
+		
+		/*
+		 * The next spectrum to look at (and which device's queue it's in), taking the queues in turn. The end of a pass waits until every
+		 * queue has got through what it was given before the pass ended, and nothing given after that is looked at until it's been.
+		 */
+		Spectrum *Next(size_t &device)
+		{
+			const Spectrum *end = 0; //the end of a pass at the front of its queue, if there is one
+			for (size_t i = 0; (i < m_queues.size()) && !end; i++){
+				Spectrum *front = m_queues[i]->Front();
+				if (front && front->end_of_sweep){
+					end = front;
+				}
+			}
+			
+			for (size_t n = 0; n < m_queues.size(); n++){
+				size_t i = (m_next + n) % m_queues.size();
+				Spectrum *front = m_queues[i]->Front();
+				if (!front){
+					continue;
+				}
+				if (end && (front != end) && (m_queues[i]->Popped() >= end->pushed[i])){ //from after the end of the pass
+					continue;
+				}
+				if (front == end){
+					bool reached = true;
+					for (size_t j = 0; j < m_queues.size(); j++){
+						reached = reached && (m_queues[j]->Popped() >= end->pushed[j]);
+					}
+					if (!reached){ //some device's spectra from before it are still queued
+						continue;
+					}
+				}
+				m_next = i + 1;
+				device = i;
+				return front;
+			}
+			return 0;
+		}
+		
+		void Run()
+		{
+			while (true){
+				bool finishing = m_finishing.load(); //read before the queues, so nothing submitted before Finish() is missed
+				size_t device;
+				Spectrum *spectrum = Next(device);
+				if (spectrum){
+					Control::Settings settings;
+					if (m_control && m_control->Changed(m_version, settings)){
+						m_analyser.SetThreshold(settings.threshold);
+						m_checker.SetThreshold(settings.threshold);
+						m_settle_count.store(m_checker.SettleCount());
+					}
+					
+					if (spectrum->end_of_sweep){
+						m_analyser.EndSweep(spectrum->timestamp);
+						if (spectrum->next_start == spectrum->next_start){ //not NaN, so the next pass covers a new range
+							m_analyser.SetRange(spectrum->next_start, spectrum->next_end);
+						}
+					}
+					else if (!spectrum->partial){
+						m_analyser.Process(*spectrum);
+					}
+					if (spectrum->check){ //the sink that sent it polls for this
+						spectrum->check->settled = m_checker.Settled(spectrum->buffer, spectrum->count, spectrum->check->signals);
+						spectrum->check->state.store(SettleCheck::ANSWERED, boost::memory_order_release);
+					}
+					m_queues[device]->Pop();
+					Freed();
+				}
+				else if (finishing){ //nothing left to do
+					fflush(stdout);
+					return;
+				}
+				else { //wait for the sinks
+					boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+				}
+			}
+		}
+		
+		unsigned int m_vector_length;
+		std::vector<boost::shared_ptr<SpectrumQueue> > m_queues; //one for each device, as each only takes one producer
+		size_t m_next;
+		boost::mutex m_space_mutex;
+		boost::condition_variable m_space; //signalled when a slot's freed with a sink waiting for one
+		boost::atomic<unsigned int> m_waiting;
+		SpectrumAnalyser m_analyser;
+		SpectrumAnalyser m_checker;
+		control_sptr m_control;
+		unsigned int m_version;
+		boost::atomic<unsigned int> m_settle_count;
+		double m_started;
+		boost::atomic<bool> m_reported;
+		boost::atomic<bool> m_finishing;
+		boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<DetectionWorker> detection_worker_sptr;
+
+#endif
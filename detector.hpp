@@ -0,0 +1,358 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef DETECTOR_HPP
+#define DETECTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "arena.hpp"
+
+/* A run of bins that stood out, in bins from the start of the spectrum */
+struct Detection {
+	unsigned int min; //where the score had fallen 3 dB below the peak's
+	unsigned int max;
+	unsigned int peak;
+};
+
+/*
+ * Decides what stands out of a spectrum. A detector scores each bin with how many dB it stands above
+ * the noise around it; Find then picks out the runs of bins that score at least the threshold, and
+ * takes each one out from its peak to where the score falls 3 dB, whichever detector scored them.
+ */
+class Detector
+{
+	public:
+		virtual ~Detector()
+		{
+		}
+		
+		virtual const char *Name() = 0;
+		
+		/* Scores n bins of powers in dB, given their averages over the fine and coarse windows */
+		virtual void Score(const float *powers, const float *fine, const float *coarse, unsigned int n, float *score) = 0;
+		
+		static void Find(const float *score, unsigned int n, float threshold, std::vector<Detection> &found)
+		{
+			found.clear();
+			
+			//start with no signal found (note: score[0] should always be very negative for the window detector, because of the way the windowing function works)
+			bool sig = false;
+			unsigned int peak = 0;
+			for (unsigned int i = 0; i < n; i++){
+				if (sig){ //we're already in a signal
+					if (score[peak] < score[i]){ //we found a rough end to the signal
+						peak = i;
+					}
+					
+					if (score[i] < threshold){ //we're transitionning to the end
+						/* look for the "start" of the signal */
+						unsigned int min = peak; //scan outwards for the minimum
+						while ((score[min] > score[peak] - 3.0) && (min > 0)){ //while the signal is still more than half power
+							min--;
+						}
+						
+						/* look for the "end" */
+						unsigned int max = peak;
+						while ((score[max] > score[peak] - 3.0) && (max < n - 1)){
+							max++;
+						}
+						sig = false; //we're now in no signal state
+						
+						Detection d = {min, max, peak};
+						found.push_back(d);
+					}
+				}
+				else {
+					if (score[i] >= threshold){ //we found a signal!
+						peak = i;
+						sig = true;
+					}
+				}
+			}
+		}
+};
+
+typedef boost::shared_ptr<Detector> detector_sptr;
+
+/* gr-scan's original detector: the fine window average against the coarse one */
+class WindowDetector : public Detector
+{
+	public:
+		const char *Name()
+		{
+			return "window";
+		}
+		
+		void Score(const float *powers, const float *fine, const float *coarse, unsigned int n, float *score)
+		{
+			for (unsigned int i = 0; i < n; i++){
+				score[i] = fine[i] - coarse[i];
+			}
+		}
+};
+
+/*
+ * Constant false alarm rate detectors: the average of the fine window around each bin against the
+ * noise floor estimated from training bins either side of it. The training bins start a fine window
+ * away (so a signal doesn't count towards its own noise) and each side is half a coarse window wide.
+ * Both slide along with the bin under test, so each spectrum takes O(n). Near the ends, where the
+ * windows run off the spectrum, they average just the bins there are (the fine window bands can't be
+ * used, as they're partial sums there).
+ */
+class CfarDetector : public Detector
+{
+	public:
+		CfarDetector(double samplewidth, double bandwidth1, double bandwidth2) :
+			m_cell(std::max(1u, (unsigned int)(bandwidth1/samplewidth)) / 2), //bins averaged either side of the bin under test
+			m_guard(std::max(1u, (unsigned int)(bandwidth1/samplewidth))), //bins skipped either side of the bin under test
+			m_training(std::max(1u, (unsigned int)(bandwidth2/samplewidth/2.0))) //bins averaged either side after that
+		{
+		}
+		
+	protected:
+		/* A running sum of some of the powers */
+		struct Sum {
+			const float *powers;
+			double total;
+			unsigned int count;
+			
+			void Add(long j)
+			{
+				total += powers[j];
+				count++;
+			}
+			
+			void Remove(long j)
+			{
+				total -= powers[j];
+				count--;
+			}
+			
+			float Mean()
+			{
+				return total / count;
+			}
+		};
+		
+		/* Moves the fine window of bin i (i > 0) on from that of bin i-1 */
+		void SlideCell(Sum &cell, long i, long n)
+		{
+			Move(cell, i + m_cell, i - m_cell - 1, n);
+		}
+		
+		/* The fine window of bin 0 */
+		void FillCell(Sum &cell, long n)
+		{
+			for (long j = 0; (j <= (long)m_cell) && (j < n); j++){
+				cell.Add(j);
+			}
+		}
+		
+		/* Moves the training bins of bin i (i > 0) on from those of bin i-1, calling Add and Remove for the bins that come and go */
+		template <typename Window> void Slide(Window &window, long i, long n)
+		{
+			long g = m_guard;
+			long t = m_training;
+			Move(window, i - g - 1, i - g - t - 1, n); //left side
+			Move(window, i + g + t, i + g, n); //right side
+		}
+		
+		/* The training bins of bin 0 */
+		template <typename Window> void Fill(Window &window, long n)
+		{
+			for (long j = m_guard + 1; (j < (long)(m_guard + m_training + 1)) && (j < n); j++){
+				window.Add(j);
+			}
+		}
+		
+		unsigned int m_cell;
+		unsigned int m_guard;
+		unsigned int m_training;
+		
+	private:
+		template <typename Window> static void Move(Window &window, long in, long out, long n)
+		{
+			if ((in >= 0) && (in < n)){
+				window.Add(in);
+			}
+			if ((out >= 0) && (out < n)){
+				window.Remove(out);
+			}
+		}
+};
+
+/* Cell averaging CFAR: the noise floor is the mean of the training bins (in dB, so a strong neighbour pulls it up less than it would in power) */
+class CaCfarDetector : public CfarDetector
+{
+	public:
+		CaCfarDetector(unsigned int max_bins, double samplewidth, double bandwidth1, double bandwidth2) :
+			CfarDetector(samplewidth, bandwidth1, bandwidth2)
+		{
+		}
+		
+		const char *Name()
+		{
+			return "ca-cfar";
+		}
+		
+		void Score(const float *powers, const float *fine, const float *coarse, unsigned int n, float *score)
+		{
+			Sum cell = {powers, 0.0, 0};
+			Sum window = {powers, 0.0, 0};
+			FillCell(cell, n);
+			Fill(window, n);
+			for (unsigned int i = 0; i < n; i++){
+				if (i > 0){
+					SlideCell(cell, i, n);
+					Slide(window, i, n);
+				}
+				score[i] = (window.count > 0) ? cell.Mean() - window.Mean() : 0.0;
+			}
+		}
+};
+
+/*
+ * Ordered statistic CFAR: the noise floor is the median of the training bins, so a signal (or two) among
+ * them doesn't raise it at all. The powers are bucketed to a tenth of a dB, and the median is a pointer
+ * into the buckets that only moves as far as the floor changes from one bin to the next.
+ */
+class OsCfarDetector : public CfarDetector
+{
+	public:
+		OsCfarDetector(unsigned int max_bins, double samplewidth, double bandwidth1, double bandwidth2) :
+			CfarDetector(samplewidth, bandwidth1, bandwidth2),
+			m_arena(Arena::Size<unsigned short>(max_bins) + Arena::Size<unsigned int>(s_buckets)),
+			m_bucket(m_arena.Take<unsigned short>(max_bins)),
+			m_histogram(m_arena.Take<unsigned int>(s_buckets))
+		{
+		}
+		
+		const char *Name()
+		{
+			return "os-cfar";
+		}
+		
+		void Score(const float *powers, const float *fine, const float *coarse, unsigned int n, float *score)
+		{
+			/* bucket the powers over the range they cover (anything not finite goes in the end buckets) */
+			float low = INFINITY;
+			float high = -INFINITY;
+			for (unsigned int i = 0; i < n; i++){
+				if (std::fabs(powers[i]) < INFINITY){
+					low = std::min(low, powers[i]);
+					high = std::max(high, powers[i]);
+				}
+			}
+			float step = std::max(0.1f, (high - low) / (s_buckets - 1));
+			for (unsigned int i = 0; i < n; i++){
+				float b = (powers[i] - low) / step;
+				m_bucket[i] = (b > 0.0f) ? (unsigned short)std::min(b, s_buckets - 1.0f) : 0; //NaN goes in bucket 0 too
+			}
+			
+			std::fill(m_histogram, m_histogram + s_buckets, 0);
+			Sum cell = {powers, 0.0, 0};
+			Median window = {m_bucket, m_histogram, 0, 0, 0};
+			FillCell(cell, n);
+			Fill(window, n);
+			for (unsigned int i = 0; i < n; i++){
+				if (i > 0){
+					SlideCell(cell, i, n);
+					Slide(window, i, n);
+				}
+				score[i] = (window.count > 0) ? cell.Mean() - (low + (window.Find() + 0.5f) * step) : 0.0;
+			}
+		}
+		
+	private:
+		static const unsigned int s_buckets = 4096;
+		
+		struct Median {
+			const unsigned short *bucket;
+			unsigned int *histogram;
+			unsigned int count; //bins in the window
+			unsigned int median; //bucket the median was in last time
+			unsigned int below; //bins in the buckets below it
+			
+			void Add(long j)
+			{
+				histogram[bucket[j]]++;
+				count++;
+				if (bucket[j] < median){
+					below++;
+				}
+			}
+			
+			void Remove(long j)
+			{
+				histogram[bucket[j]]--;
+				count--;
+				if (bucket[j] < median){
+					below--;
+				}
+			}
+			
+			/* Moves the pointer to the bucket the median's in now */
+			unsigned int Find()
+			{
+				unsigned int rank = (count - 1) / 2;
+				while (below > rank){
+					median--;
+					below -= histogram[median];
+				}
+				while (below + histogram[median] <= rank){
+					below += histogram[median];
+					median++;
+				}
+				return median;
+			}
+		};
+		
+		Arena m_arena;
+		unsigned short *m_bucket; //bucket of each bin
+		unsigned int *m_histogram; //bins of the window in each bucket
+};
+
+/* Whether there's a detector called name */
+static bool KnownDetector(const std::string &name)
+{
+	return (name == "window") || (name == "ca-cfar") || (name == "os-cfar");
+}
+
+/* A detector called name, for spectra of up to max_bins bins of samplewidth Hz */
+static detector_sptr MakeDetector(const std::string &name, unsigned int max_bins, double samplewidth, double bandwidth1, double bandwidth2)
+{
+	if (name == "window"){
+		return detector_sptr(new WindowDetector());
+	}
+	if (name == "ca-cfar"){
+		return detector_sptr(new CaCfarDetector(max_bins, samplewidth, bandwidth1, bandwidth2));
+	}
+	if (name == "os-cfar"){
+		return detector_sptr(new OsCfarDetector(max_bins, samplewidth, bandwidth1, bandwidth2));
+	}
+	throw std::invalid_argument("no detector called " + name);
+}
+
+#endif
@@ -0,0 +1,266 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef GOERTZEL_BANK_HPP
+#define GOERTZEL_BANK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/fft/fft.h>
+#include "tuner.hpp"
+#include "watchlist.hpp"
+
+/*
+ * Works out just the bins of the power spectrum that the watched channels in the current window (and
+ * their reference bands) fall in, leaving the rest of the spectrum 0, laid out like an FFT's so the
+ * sink can't tell the difference. Where a window needs only a few bins, each gets a Goertzel filter:
+ * about 6 floating point operations a sample (done in double, as a float one drifts by dBs over a
+ * long frame), against about 5 log2(N) for the whole of an N point FFT. Windows that need more bins
+ * than that makes worthwhile get an FFT instead. The window it works on is switched by SetCentre (see
+ * goertzel_tuner), and the frames are windowed, and start every hop samples, just like batch_fft's.
+ */
+class goertzel_bank : public gr::sync_decimator
+{
+	public:
+		goertzel_bank(unsigned int vector_length, unsigned int hop, double sample_rate, const std::vector<float> &window, watchlist_sptr watchlist,
+				bool cu8) :
+			gr::sync_decimator ("goertzel_bank",
+				gr::io_signature::make (1, 1, cu8 ? 2 : sizeof (gr_complex)),
+				gr::io_signature::make (1, 1, sizeof (float) * vector_length),
+				hop),
+			m_vector_length(vector_length), //size of the FFT we stand in for
+			m_hop(hop), //samples from the start of one frame to the next
+			m_cu8(cu8),
+			m_window(window),
+			m_watchlist(watchlist),
+			m_fft(0), //for the windows with too many bins to filter (if there are any)
+			m_filtered(0), //windows with few enough bins to filter
+			m_most(0), //most bins a filtered window has
+			m_current(-1) //window we're working out the bins of (none until we're tuned)
+		{
+			set_history(vector_length - hop + 1); //the end of the frame before, which each frame starts with
+			if (m_cu8){ //taking in the scaling to +-1 as well
+				for (unsigned int i = 0; i < vector_length; i++){
+					m_window[i] /= 127.5f;
+				}
+			}
+			
+			/* the bins of every window, in FFT order (0 Hz first, then the positive frequencies, then the negative) */
+			double binwidth = sample_rate / vector_length;
+			const std::vector<Watchlist::Window> &windows = watchlist->Windows();
+			for (size_t w = 0; w < windows.size(); w++){
+				std::set<unsigned int> bins;
+				for (size_t c = 0; c < windows[w].channels.size(); c++){
+					unsigned int lowest, first, last, end;
+					Watchlist::Bins(windows[w].channels[c], windows[w].centre, binwidth, vector_length, lowest, first, last, end);
+					for (unsigned int i = lowest; i < end; i++){
+						bins.insert((i + vector_length/2) % vector_length);
+					}
+				}
+				
+				Filters filters;
+				filters.fft = (6.0 * bins.size() > 5.0 * std::log(double(vector_length)) / std::log(2.0));
+				for (std::set<unsigned int>::iterator it = bins.begin(); it != bins.end(); ++it){
+					double omega = 2.0 * M_PI * *it / vector_length;
+					filters.bins.push_back(*it);
+					filters.coefficients.push_back(2.0 * std::cos(omega));
+					filters.cosines.push_back(std::cos(omega));
+					filters.sines.push_back(std::sin(omega));
+				}
+				m_filters.push_back(filters);
+				
+				if (filters.fft && !m_fft){
+					m_fft = new gr::fft::fft_complex(vector_length, true, 1);
+				}
+				else if (!filters.fft){
+					m_filtered++;
+					m_most = std::max(m_most, filters.bins.size());
+				}
+			}
+			m_state.resize(4 * m_most);
+		}
+		
+		virtual ~goertzel_bank()
+		{
+			delete m_fft;
+		}
+		
+		/* Starts working out the bins of the window tuned to freq, from the next call to work (from the retuner's thread) */
+		void SetCentre(double freq)
+		{
+			m_current.store(m_watchlist->Find(freq));
+		}
+		
+		/* Windows with few enough bins to work out with Goertzel filters */
+		unsigned int Filtered()
+		{
+			return m_filtered;
+		}
+		
+		/* The most bins any of those needs */
+		size_t MostBins()
+		{
+			return m_most;
+		}
+		
+	private:
+		struct Filters {
+			bool fft; //too many bins to be worth filtering
+			std::vector<unsigned int> bins;
+			std::vector<double> coefficients; //2cos(omega)
+			std::vector<double> cosines; //to turn the last two states into the bin
+			std::vector<double> sines;
+		};
+		
+		virtual int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+		{
+			const char *in = (const char *)input_items[0];
+			float *out = (float *)output_items[0];
+			int current = m_current.load();
+			for (int f = 0; f < noutput_items; f++, in += m_hop * (m_cu8 ? 2 : sizeof(gr_complex)), out += m_vector_length){
+				std::fill(out, out + m_vector_length, 0.0f);
+				if ((current >= 0) && m_filters[current].fft){
+					Transform(m_filters[current], in, out);
+				}
+				else if (current >= 0){
+					Filter(m_filters[current], in, out);
+				}
+			}
+			return noutput_items;
+		}
+		
+		/* Transforms a frame, putting the power in the window's bins in out */
+		void Transform(const Filters &filters, const char *in, float *out)
+		{
+			gr_complex *buffer = m_fft->get_inbuf();
+			const gr_complex *result = m_fft->get_outbuf();
+			for (unsigned int i = 0; i < m_vector_length; i++){
+				if (m_cu8){
+					buffer[i] = gr_complex((((const unsigned char *)in)[2*i] - 127.5f) * m_window[i], (((const unsigned char *)in)[2*i + 1] - 127.5f) * m_window[i]);
+				}
+				else {
+					buffer[i] = ((const gr_complex *)in)[i] * m_window[i];
+				}
+			}
+			m_fft->execute();
+			for (size_t b = 0; b < filters.bins.size(); b++){
+				out[filters.bins[b]] = std::norm(result[filters.bins[b]]);
+			}
+		}
+		
+		/* Runs the filters over a frame, putting the power in each of their bins in out */
+		void Filter(const Filters &filters, const char *in, float *out)
+		{
+			size_t n = filters.bins.size();
+			double *real1 = &m_state[0]; //the state one sample back, for each filter (in double, as a float one drifts by dBs over a long FFT)
+			double *imag1 = real1 + n;
+			double *real2 = imag1 + n; //and two samples back
+			double *imag2 = real2 + n;
+			std::fill(real1, real1 + 4 * n, 0.0);
+			
+			const double *coefficients = &filters.coefficients[0];
+			for (unsigned int i = 0; i < m_vector_length; i++){
+				float re, im;
+				if (m_cu8){
+					re = (((const unsigned char *)in)[2*i] - 127.5f) * m_window[i];
+					im = (((const unsigned char *)in)[2*i + 1] - 127.5f) * m_window[i];
+				}
+				else {
+					re = ((const gr_complex *)in)[i].real() * m_window[i];
+					im = ((const gr_complex *)in)[i].imag() * m_window[i];
+				}
+				
+				for (size_t b = 0; b < n; b++){ //the filters are independent, so this vectorises
+					double real = re + coefficients[b] * real1[b] - real2[b];
+					double imag = im + coefficients[b] * imag1[b] - imag2[b];
+					real2[b] = real1[b];
+					imag2[b] = imag1[b];
+					real1[b] = real;
+					imag1[b] = imag;
+				}
+			}
+			
+			/* the bin is the last state less the one before turned back by omega (give or take a phase, which the power doesn't care about) */
+			for (size_t b = 0; b < n; b++){
+				double real = real1[b] - (filters.cosines[b] * real2[b] + filters.sines[b] * imag2[b]);
+				double imag = imag1[b] - (filters.cosines[b] * imag2[b] - filters.sines[b] * real2[b]);
+				out[filters.bins[b]] = real * real + imag * imag;
+			}
+		}
+		
+		unsigned int m_vector_length;
+		unsigned int m_hop;
+		bool m_cu8;
+		std::vector<float> m_window;
+		watchlist_sptr m_watchlist;
+		std::vector<Filters> m_filters; //for each window
+		gr::fft::fft_complex *m_fft;
+		unsigned int m_filtered;
+		size_t m_most;
+		std::vector<double> m_state;
+		boost::atomic<int> m_current;
+};
+
+/* Shared pointer thing gnuradio is fond of */
+typedef boost::shared_ptr<goertzel_bank> goertzel_bank_sptr;
+goertzel_bank_sptr make_goertzel_bank(unsigned int vector_length, unsigned int hop, double sample_rate, const std::vector<float> &window,
+	watchlist_sptr watchlist, bool cu8)
+{
+	return boost::shared_ptr<goertzel_bank>(new goertzel_bank(vector_length, hop, sample_rate, window, watchlist, cu8));
+}
+
+/* Retunes a device feeding a Goertzel bank, switching the bank to the window's bins as it goes */
+class goertzel_tuner : public Tuner
+{
+	public:
+		goertzel_tuner(tuner_sptr tuner, goertzel_bank_sptr bank) :
+			m_tuner(tuner),
+			m_bank(bank)
+		{
+		}
+		
+		virtual double set_center_freq(double freq)
+		{
+			m_bank->SetCentre(freq); //before the radio moves, so no new samples get the old window's bins
+			return m_tuner->set_center_freq(freq);
+		}
+		
+		virtual double set_gain(double gain)
+		{
+			return m_tuner->set_gain(gain);
+		}
+		
+	private:
+		tuner_sptr m_tuner;
+		goertzel_bank_sptr m_bank;
+};
+
+tuner_sptr make_goertzel_tuner(tuner_sptr tuner, goertzel_bank_sptr bank)
+{
+	return tuner_sptr(new goertzel_tuner(tuner, bank));
+}
+
+#endif
@@ -0,0 +1,272 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+/*
+ * Reads back a spectrum log written with gr-scan --spectrum-log, without going near a radio:
+ *
+ *	gr-scan-log LOG info
+ *		lists the spectra in the log
+ *	gr-scan-log [-f KHZ] [-c KHZ] [-s KHZ] [-t DB] [-k DETECTOR] LOG detect
+ *		runs the detector over them again, printing signals just like gr-scan does
+ *	gr-scan-log [--min DB] [--max DB] LOG waterfall OUT.pgm
+ *		draws them as a greyscale waterfall, one row per spectrum (oldest at the top)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <argp.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include "spectrum_analyser.hpp"
+#include "spectrum_log.hpp"
+
+class LogArguments
+{
+	public:
+		LogArguments(int argc, char **argv) :
+			bandwidth1(25000.0),
+			bandwidth2(-1.0),
+			spread(50000.0),
+			threshold(3.0),
+			detector("window"),
+			min_db(NAN),
+			max_db(NAN)
+		{
+			argp_parse (&argp_i, argc, argv, 0, 0, this);
+			if (bandwidth2 < 0.0){ //same default as gr-scan
+				bandwidth2 = bandwidth1 * 8.0;
+			}
+		}
+		
+		std::string log;
+		std::string command;
+		std::string output;
+		double bandwidth1;
+		double bandwidth2;
+		double spread;
+		double threshold;
+		std::string detector;
+		double min_db; //waterfall range (NaN to fit the log)
+		double max_db;
+		
+	private:
+		static error_t s_parse_opt(int key, char *arg, struct argp_state *state)
+		{
+			LogArguments *arguments = (LogArguments *)state->input;
+			return arguments->parse_opt (key, arg, state);
+		}
+		
+		error_t parse_opt (int key, char *arg, struct argp_state *state)
+		{
+			switch (key)
+			{
+				case 'f':
+					bandwidth1 = atof(arg) * 1000.0; //kHz
+					break;
+				case 'c':
+					bandwidth2 = atof(arg) * 1000.0; //kHz
+					break;
+				case 's':
+					spread = atof(arg) * 1000.0; //kHz
+					break;
+				case 't':
+					threshold = atof(arg);
+					break;
+				case 'k':
+					detector = arg;
+					break;
+				case 'n':
+					min_db = atof(arg);
+					break;
+				case 'm':
+					max_db = atof(arg);
+					break;
+				case ARGP_KEY_ARG:
+					if (state->arg_num == 0){
+						log = arg;
+					}
+					else if (state->arg_num == 1){
+						command = arg;
+					}
+					else if ((state->arg_num == 2) && (command == "waterfall")){
+						output = arg;
+					}
+					else {
+						argp_usage(state);
+					}
+					break;
+				case ARGP_KEY_END:
+					if ((command != "info") && (command != "detect") && (command != "waterfall")){
+						argp_usage(state);
+					}
+					if (!KnownDetector(detector)){
+						argp_error(state, "--detector must be window, ca-cfar or os-cfar");
+					}
+					if ((command == "waterfall") && output.empty()){
+						argp_error(state, "waterfall needs a file to draw to");
+					}
+					break;
+				default:
+					return ARGP_ERR_UNKNOWN;
+			}
+			return 0;
+		}
+		
+		static argp_option options[];
+		static argp argp_i;
+};
+
+argp_option LogArguments::options[] = {
+	{"fine-bandwidth", 'f', "FREQ", 0, "Bandwidth of the fine window in kHz for detect"},
+	{"coarse-bandwidth", 'c', "FREQ", 0, "Bandwidth of the coarse window in kHz for detect"},
+	{"spread", 's', "FREQ", 0, "Minimum frequency between detected signals in kHz for detect"},
+	{"threshold", 't', "POWER", 0, "Threshold for the difference between the coarse and fine filtered signal in dB for detect"},
+	{"detector", 'k', "NAME", 0, "Detector for detect: window, ca-cfar or os-cfar"},
+	{"min", 'n', "POWER", 0, "Power in dB drawn black in the waterfall (default the lowest in the log)"},
+	{"max", 'm', "POWER", 0, "Power in dB drawn white in the waterfall (default the highest in the log)"},
+	{0}
+};
+argp LogArguments::argp_i = {options, s_parse_opt, "LOG info|detect|waterfall [OUT.pgm]", "Reads back a gr-scan spectrum log"};
+
+const char *argp_program_version = VERSION " log reader";
+
+static void Info(SpectrumLogReader &reader)
+{
+	for (size_t i = 0; i < reader.Size(); i++){
+		const SpectrumLogReader::Record &record = reader.Get(i);
+		time_t seconds = record.timestamp;
+		char when[32];
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+		printf("%lu %s: %f MHz - %f MHz, %u bins of %f kHz\n", (unsigned long)i, when, (record.centre - record.bins*record.bin_width/2.0)/1000000.0,
+			(record.centre + record.bins*record.bin_width/2.0)/1000000.0, record.bins, record.bin_width/1000.0);
+	}
+	fprintf(stderr, "[*] %lu spectra\n", (unsigned long)reader.Size());
+}
+
+/* Runs the spectra past an analyser set up for their size (a zoomed sweep logs more than one) */
+static void Detect(SpectrumLogReader &reader, const LogArguments &args)
+{
+	if (reader.Size() == 0){
+		return;
+	}
+	double low = reader.Get(0).centre;
+	double high = low;
+	for (size_t i = 0; i < reader.Size(); i++){
+		low = std::min(low, reader.Get(i).centre);
+		high = std::max(high, reader.Get(i).centre);
+	}
+	
+	typedef std::pair<unsigned int, double> Shape; //bins and bin width
+	std::map<Shape, boost::shared_ptr<SpectrumAnalyser> > analysers;
+	std::vector<float> bands;
+	for (size_t i = 0; i < reader.Size(); i++){
+		const SpectrumLogReader::Record &record = reader.Get(i);
+		boost::shared_ptr<SpectrumAnalyser> &analyser = analysers[Shape(record.bins, record.bin_width)];
+		if (!analyser){
+			analyser.reset(new SpectrumAnalyser(record.bins, record.bins * record.bin_width, args.bandwidth1, args.bandwidth2, 1, args.spread, args.threshold,
+				false, 0.0, low, high, 0.0, 100000, 0.0, 1));
+			analyser->SetDetector(args.detector);
+			analyser->SetStartTime(reader.Get(0).timestamp); //so times are from the start of the log
+		}
+		bands.resize(record.bins);
+		reader.Read(i, &bands[0]);
+		analyser->ProcessBands(&bands[0], record.centre, record.timestamp);
+	}
+}
+
+/* Writes a binary PGM, as wide as the first spectrum (longer ones are cut short, shorter ones padded with black) */
+static void Waterfall(SpectrumLogReader &reader, const LogArguments &args)
+{
+	if (reader.Size() == 0){
+		throw std::runtime_error("nothing to draw");
+	}
+	unsigned int width = reader.Get(0).bins;
+	std::vector<float> bands;
+	
+	double low = args.min_db;
+	double high = args.max_db;
+	if ((low != low) || (high != high)){ //fit whichever end wasn't given to the log
+		float lowest = INFINITY;
+		float highest = -INFINITY;
+		for (size_t i = 0; i < reader.Size(); i++){
+			bands.resize(reader.Get(i).bins);
+			reader.Read(i, &bands[0]);
+			for (size_t j = 0; j < bands.size(); j++){
+				if (bands[j] == bands[j]){
+					lowest = std::min(lowest, bands[j]);
+					highest = std::max(highest, bands[j]);
+				}
+			}
+		}
+		low = (low != low) ? lowest : low;
+		high = (high != high) ? highest : high;
+	}
+	double scale = (high > low) ? 255.0 / (high - low) : 0.0;
+	
+	FILE *file = fopen(args.output.c_str(), "wb");
+	if (!file){
+		throw std::runtime_error("can't open " + args.output);
+	}
+	fprintf(file, "P5\n%u %lu\n255\n", width, (unsigned long)reader.Size());
+	std::vector<unsigned char> row(width);
+	for (size_t i = 0; i < reader.Size(); i++){
+		bands.resize(reader.Get(i).bins);
+		reader.Read(i, &bands[0]);
+		for (unsigned int j = 0; j < width; j++){
+			float db = (j < bands.size()) ? bands[j] : NAN;
+			row[j] = (db == db) ? (unsigned char)std::max(std::min((db - low) * scale, 255.0), 0.0) : 0;
+		}
+		fwrite(&row[0], 1, width, file);
+	}
+	if (fclose(file) != 0){
+		throw std::runtime_error("can't write " + args.output);
+	}
+	fprintf(stderr, "[*] Drew %lu spectra from %f dB to %f dB\n", (unsigned long)reader.Size(), low, high);
+}
+
+int main(int argc, char **argv)
+{
+	LogArguments args(argc, argv);
+	try {
+		SpectrumLogReader reader(args.log);
+		if (args.command == "info"){
+			Info(reader);
+		}
+		else if (args.command == "detect"){
+			Detect(reader, args);
+		}
+		else {
+			Waterfall(reader, args);
+		}
+	}
+	catch (std::exception &e){
+		fprintf(stderr, "[-] %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
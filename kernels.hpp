@@ -0,0 +1,232 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_AVX2
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define KERNELS_NEON
+#endif
+
+/*
+ * The loops run over every bin of every FFT. AVX2 versions are picked at startup if the CPU has it;
+ * NEON is part of every CPU we'd be built for on ARM, so there it's picked when compiling.
+ */
+class Kernels
+{
+	public:
+		/* Adds an FFT (DC first) to a total kept with 0 Hz in the middle, so the total never needs rearranging */
+		static void AccumulateShifted(float *total, const float *in, unsigned int n)
+		{
+			unsigned int half = n/2;
+			Get().add(total + half, in, half); //lower half of the FFT (positive frequencies)
+			Get().add(total, in + half, n - half); //upper half of the FFT (negative frequencies)
+		}
+		
+		/* out = in * factor */
+		static void Scale(float *out, const float *in, float factor, unsigned int n)
+		{
+			Get().scale(out, in, factor, n);
+		}
+		
+		static void Clear(float *buffer, unsigned int n)
+		{
+			Get().clear(buffer, n);
+		}
+		
+		/* Turns n unsigned 8 bit samples (I and Q each count) into floats and windows them: out = (in - 127.5) * window */
+		static void WindowCu8(float *out, const unsigned char *in, const float *window, unsigned int n)
+		{
+			Get().window_cu8(out, in, window, n);
+		}
+		
+		/* Which versions we're using */
+		static const char *Name()
+		{
+			return Get().name;
+		}
+		
+	private:
+		struct Table {
+			const char *name;
+			void (*add)(float *, const float *, unsigned int);
+			void (*scale)(float *, const float *, float, unsigned int);
+			void (*clear)(float *, unsigned int);
+			void (*window_cu8)(float *, const unsigned char *, const float *, unsigned int);
+		};
+		
+		static const Table &Get()
+		{
+			static const Table table = Pick();
+			return table;
+		}
+		
+		static Table Pick()
+		{
+#ifdef KERNELS_AVX2
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")){
+				Table avx2 = {"avx2", AddAVX2, ScaleAVX2, ClearAVX2, WindowCu8AVX2};
+				return avx2;
+			}
+#endif
+#ifdef KERNELS_NEON
+			Table neon = {"neon", AddNEON, ScaleNEON, ClearNEON, WindowCu8NEON};
+			return neon;
+#endif
+			Table scalar = {"scalar", AddScalar, ScaleScalar, ClearScalar, WindowCu8Scalar};
+			return scalar;
+		}
+		
+		static void AddScalar(float *total, const float *in, unsigned int n)
+		{
+			for (unsigned int i = 0; i < n; i++){
+				total[i] += in[i];
+			}
+		}
+		
+		static void ScaleScalar(float *out, const float *in, float factor, unsigned int n)
+		{
+			for (unsigned int i = 0; i < n; i++){
+				out[i] = in[i] * factor;
+			}
+		}
+		
+		static void ClearScalar(float *buffer, unsigned int n)
+		{
+			memset(buffer, 0, n * sizeof(float));
+		}
+		
+		static void WindowCu8Scalar(float *out, const unsigned char *in, const float *window, unsigned int n)
+		{
+			for (unsigned int i = 0; i < n; i++){
+				out[i] = (in[i] - 127.5f) * window[i];
+			}
+		}
+		
+#ifdef KERNELS_AVX2
+		__attribute__((target("avx2"))) static void AddAVX2(float *total, const float *in, unsigned int n)
+		{
+			unsigned int i = 0;
+			for (; i + 8 <= n; i += 8){
+				_mm256_storeu_ps(total + i, _mm256_add_ps(_mm256_loadu_ps(total + i), _mm256_loadu_ps(in + i)));
+			}
+			for (; i < n; i++){
+				total[i] += in[i];
+			}
+		}
+		
+		__attribute__((target("avx2"))) static void ScaleAVX2(float *out, const float *in, float factor, unsigned int n)
+		{
+			__m256 f = _mm256_set1_ps(factor);
+			unsigned int i = 0;
+			for (; i + 8 <= n; i += 8){
+				_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), f));
+			}
+			for (; i < n; i++){
+				out[i] = in[i] * factor;
+			}
+		}
+		
+		__attribute__((target("avx2"))) static void ClearAVX2(float *buffer, unsigned int n)
+		{
+			__m256 zero = _mm256_setzero_ps();
+			unsigned int i = 0;
+			for (; i + 8 <= n; i += 8){
+				_mm256_storeu_ps(buffer + i, zero);
+			}
+			for (; i < n; i++){
+				buffer[i] = 0.0;
+			}
+		}
+		
+		__attribute__((target("avx2"))) static void WindowCu8AVX2(float *out, const unsigned char *in, const float *window, unsigned int n)
+		{
+			__m256 offset = _mm256_set1_ps(127.5f);
+			unsigned int i = 0;
+			for (; i + 8 <= n; i += 8){
+				__m256 samples = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + i))));
+				_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_sub_ps(samples, offset), _mm256_loadu_ps(window + i)));
+			}
+			for (; i < n; i++){
+				out[i] = (in[i] - 127.5f) * window[i];
+			}
+		}
+#endif
+		
+#ifdef KERNELS_NEON
+		static void AddNEON(float *total, const float *in, unsigned int n)
+		{
+			unsigned int i = 0;
+			for (; i + 4 <= n; i += 4){
+				vst1q_f32(total + i, vaddq_f32(vld1q_f32(total + i), vld1q_f32(in + i)));
+			}
+			for (; i < n; i++){
+				total[i] += in[i];
+			}
+		}
+		
+		static void ScaleNEON(float *out, const float *in, float factor, unsigned int n)
+		{
+			unsigned int i = 0;
+			for (; i + 4 <= n; i += 4){
+				vst1q_f32(out + i, vmulq_n_f32(vld1q_f32(in + i), factor));
+			}
+			for (; i < n; i++){
+				out[i] = in[i] * factor;
+			}
+		}
+		
+		static void ClearNEON(float *buffer, unsigned int n)
+		{
+			float32x4_t zero = vdupq_n_f32(0.0f);
+			unsigned int i = 0;
+			for (; i + 4 <= n; i += 4){
+				vst1q_f32(buffer + i, zero);
+			}
+			for (; i < n; i++){
+				buffer[i] = 0.0;
+			}
+		}
+		
+		static void WindowCu8NEON(float *out, const unsigned char *in, const float *window, unsigned int n)
+		{
+			float32x4_t offset = vdupq_n_f32(127.5f);
+			unsigned int i = 0;
+			for (; i + 8 <= n; i += 8){
+				uint16x8_t samples = vmovl_u8(vld1_u8(in + i));
+				float32x4_t low = vcvtq_f32_u32(vmovl_u16(vget_low_u16(samples)));
+				float32x4_t high = vcvtq_f32_u32(vmovl_u16(vget_high_u16(samples)));
+				vst1q_f32(out + i, vmulq_f32(vsubq_f32(low, offset), vld1q_f32(window + i)));
+				vst1q_f32(out + i + 4, vmulq_f32(vsubq_f32(high, offset), vld1q_f32(window + i + 4)));
+			}
+			for (; i < n; i++){
+				out[i] = (in[i] - 127.5f) * window[i];
+			}
+		}
+#endif
+};
+
+#endif
@@ -17,27 +17,61 @@
 */
 
 
+#include <csignal>
 #include <cstdio>
 
 #include "arguments.hpp"
 #include "topblock.hpp"
 
+/* Lets the sink finish cleanly, so everything found so far gets printed */
+static void Interrupt(int sig)
+{
+	signal(sig, SIG_DFL); //a second one kills us outright
+	scanner_sink::Stop();
+}
+
 int main(int argc, char **argv)
 {
 	Arguments arguments(argc, argv);
 	
-	TopBlock top_block(
-		arguments.get_centre_freq_1(),
-		arguments.get_centre_freq_2(),
-		arguments.get_sample_rate(),
-		arguments.get_fft_width(),
-		arguments.get_bandwidth1(),
-		arguments.get_bandwidth2(),
-		arguments.get_step(),
-		arguments.get_avg_size(),
-		arguments.get_spread(),
-		arguments.get_threshold(),
-		arguments.get_time());
-	top_block.run();
-	return 0; //actually, we never get here because of the rude way in which we end the scan
+	TopBlock::Settings settings;
+	settings.centre_freq_1 = arguments.get_centre_freq_1();
+	settings.centre_freq_2 = arguments.get_centre_freq_2();
+	settings.sample_rate = arguments.get_sample_rate();
+	settings.fft_width = arguments.get_fft_width();
+	settings.bandwidth1 = arguments.get_bandwidth1();
+	settings.bandwidth2 = arguments.get_bandwidth2();
+	settings.step = arguments.get_step();
+	settings.avg_size = arguments.get_avg_size();
+	settings.spread = arguments.get_spread();
+	settings.threshold = arguments.get_threshold();
+	settings.ptime = arguments.get_time();
+	settings.db_average = arguments.get_db_average();
+	settings.devices = arguments.get_devices();
+	settings.replays = arguments.get_replays();
+	settings.queue_size = arguments.get_queue_size();
+	settings.settle = arguments.get_settle();
+	settings.use_tags = arguments.get_use_tags();
+	settings.stitch = arguments.get_stitch();
+	settings.max_signals = arguments.get_max_signals();
+	settings.max_age = arguments.get_max_age();
+	settings.passes = arguments.get_passes();
+	settings.zoom = arguments.get_zoom();
+	settings.adaptive = arguments.get_adaptive();
+	settings.fft_threads = arguments.get_fft_threads();
+	settings.fft_batch = arguments.get_fft_batch();
+	settings.metrics_target = arguments.get_metrics_target();
+	settings.metrics_period = arguments.get_metrics_period();
+	settings.spectrum_log = arguments.get_spectrum_log();
+	settings.detector = arguments.get_detector();
+	settings.cu8 = arguments.get_cu8();
+	settings.overlap = arguments.get_overlap();
+	settings.control_socket = arguments.get_control_socket();
+	settings.watchlist = arguments.get_watchlist();
+	TopBlock top_block(settings);
+	
+	signal(SIGINT, Interrupt);
+	signal(SIGTERM, Interrupt);
+	top_block.Run(); //returns once the sink has reached the end frequency (for the last time), or been interrupted
+	return 0;
 }
@@ -0,0 +1,321 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <gnuradio/block.h>
+#include <gnuradio/high_res_timer.h>
+#include "detection_worker.hpp"
+#include "unix_socket.hpp"
+
+/*
+ * Counts what the flowgraph gets up to, and publishes it in the Prometheus text format: either by
+ * rewriting a file every period seconds (for node_exporter's textfile collector, say), or to whatever
+ * connects to a UNIX socket if the target is unix:PATH. The sinks count as they go; the block work times
+ * and buffer fullness are GNU Radio's performance counters, read when a snapshot is taken.
+ */
+class Metrics
+{
+	public:
+		Metrics() :
+			m_spectra(0), //averaged spectra handed to detection
+			m_overflows(0), //times a source said it had dropped samples
+			m_hops(0), //retunes that worked
+			m_retried(0), //of those, the ones that took more than one go
+			m_retunes(0), //calls to set_center_freq
+			m_retune_total(0.0), //seconds spent in them
+			m_retune_max(0.0),
+			m_last_spectra(0), //for the spectra per second since the last snapshot
+			m_last_time(Now()),
+			m_period(5.0),
+			m_listener(-1),
+			m_stop(false),
+			m_enabled(false)
+		{
+		}
+		
+		~Metrics()
+		{
+			Stop();
+		}
+		
+		/* Starts publishing to target (a file, or unix:PATH) */
+		void Start(const std::string &target, double period)
+		{
+			m_period = period;
+			if (target.compare(0, 5, "unix:") == 0){
+				m_socket = target.substr(5);
+				m_listener = ListenUnix(m_socket, "metrics");
+			}
+			else {
+				m_file = target;
+			}
+			m_enabled = true;
+			m_thread = boost::thread(&Metrics::Run, this);
+		}
+		
+		/* Stops publishing, after writing a last snapshot to the file */
+		void Stop()
+		{
+			if (!m_enabled){
+				return;
+			}
+			m_stop.store(true);
+			m_thread.join();
+			if (m_listener >= 0){
+				close(m_listener);
+				unlink(m_socket.c_str());
+			}
+			else {
+				WriteFile();
+			}
+			m_enabled = false;
+		}
+		
+		/* Whether anyone's going to see the numbers (so the sinks can skip what's only done for them) */
+		bool Enabled()
+		{
+			return m_enabled;
+		}
+		
+		/* Adds a block to report the performance counters of (anything that isn't a gr::block, like a hier block, is left out) */
+		void AddBlock(const std::string &stage, unsigned int device, gr::basic_block_sptr block)
+		{
+			gr::block_sptr b = boost::dynamic_pointer_cast<gr::block>(block);
+			if (b){
+				boost::mutex::scoped_lock lock(m_mutex);
+				Stage s = {stage, device, b};
+				m_stages.push_back(s);
+			}
+		}
+		
+		/* Forgets the blocks and worker of the last flowgraph, and reports the queue of worker instead */
+		void SetWorker(detection_worker_sptr worker)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_stages.clear();
+			m_worker = worker;
+		}
+		
+		void CountSpectrum()
+		{
+			m_spectra.fetch_add(1, boost::memory_order_relaxed);
+		}
+		
+		void CountOverflow()
+		{
+			m_overflows.fetch_add(1, boost::memory_order_relaxed);
+		}
+		
+		/* A call to set_center_freq that took seconds */
+		void Retuned(double seconds)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_retunes++;
+			m_retune_total += seconds;
+			m_retune_max = std::max(m_retune_max, seconds);
+		}
+		
+		/* A hop to a new frequency that took attempts retunes */
+		void Hopped(unsigned int attempts)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_hops++;
+			if (attempts > 1){
+				m_retried++;
+			}
+		}
+		
+		/* Everything, in the Prometheus text format */
+		std::string Snapshot()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			std::string out;
+			double now = Now();
+			uint64_t spectra = m_spectra.load(boost::memory_order_relaxed);
+			double rate = (now > m_last_time) ? (spectra - m_last_spectra) / (now - m_last_time) : 0.0;
+			m_last_spectra = spectra;
+			m_last_time = now;
+			
+			Header(out, "grscan_spectra_total", "counter", "Averaged spectra handed to detection");
+			Line(out, "grscan_spectra_total %llu\n", (unsigned long long)spectra);
+			Header(out, "grscan_spectra_per_second", "gauge", "Averaged spectra per second since the last snapshot");
+			Line(out, "grscan_spectra_per_second %g\n", rate);
+			
+			Header(out, "grscan_retune_seconds", "summary", "Time spent in set_center_freq");
+			Line(out, "grscan_retune_seconds_sum %g\n", m_retune_total);
+			Line(out, "grscan_retune_seconds_count %llu\n", (unsigned long long)m_retunes);
+			Header(out, "grscan_retune_seconds_max", "gauge", "Longest call to set_center_freq");
+			Line(out, "grscan_retune_seconds_max %g\n", m_retune_max);
+			Header(out, "grscan_hops_total", "counter", "Retunes to a new frequency that worked");
+			Line(out, "grscan_hops_total %llu\n", (unsigned long long)m_hops);
+			Header(out, "grscan_hops_retried_total", "counter", "Hops that needed more than one retune (the source couldn't make a frequency)");
+			Line(out, "grscan_hops_retried_total %llu\n", (unsigned long long)m_retried);
+			
+			Header(out, "grscan_source_overflows_total", "counter", "Times a source re-tagged rx_time after dropping samples (UHD sources and the 8 bit RTL source do, others don't say)");
+			Line(out, "grscan_source_overflows_total %llu\n", (unsigned long long)m_overflows.load(boost::memory_order_relaxed));
+			
+			if (m_worker){
+				Header(out, "grscan_queue_depth", "gauge", "Spectra waiting for detection");
+				Line(out, "grscan_queue_depth %lu\n", (unsigned long)m_worker->QueueDepth());
+				Header(out, "grscan_queue_capacity", "gauge", "Spectra that can wait for detection before the sinks block");
+				Line(out, "grscan_queue_capacity %lu\n", (unsigned long)m_worker->QueueCapacity());
+			}
+			
+			Header(out, "grscan_block_work_seconds_total", "counter", "Time spent in each block's work function");
+			for (size_t i = 0; i < m_stages.size(); i++){
+				Line(out, "grscan_block_work_seconds_total{stage=\"%s\",device=\"%u\"} %g\n", m_stages[i].name.c_str(), m_stages[i].device,
+					m_stages[i].block->pc_work_time_total() / (double)gr::high_res_timer_tps());
+			}
+			Header(out, "grscan_block_input_buffer_full_ratio", "gauge", "How full each block's input buffer is on average");
+			for (size_t i = 0; i < m_stages.size(); i++){
+				if (m_stages[i].name != "source"){
+					Line(out, "grscan_block_input_buffer_full_ratio{stage=\"%s\",device=\"%u\"} %g\n", m_stages[i].name.c_str(), m_stages[i].device,
+						m_stages[i].block->pc_input_buffers_full(0));
+				}
+			}
+			Header(out, "grscan_block_output_buffer_full_ratio", "gauge", "How full each block's output buffer is on average (a full one after the source means samples are being dropped)");
+			for (size_t i = 0; i < m_stages.size(); i++){
+				if (m_stages[i].name != "sink"){
+					Line(out, "grscan_block_output_buffer_full_ratio{stage=\"%s\",device=\"%u\"} %g\n", m_stages[i].name.c_str(), m_stages[i].device,
+						m_stages[i].block->pc_output_buffers_full(0));
+				}
+			}
+			return out;
+		}
+		
+	private:
+		struct Stage {
+			std::string name;
+			unsigned int device;
+			gr::block_sptr block;
+		};
+		
+		void Run()
+		{
+			double next = Now() + m_period;
+			while (!m_stop.load()){
+				if (m_listener >= 0){ //answer whoever connects
+					struct pollfd fd = {m_listener, POLLIN, 0};
+					if (poll(&fd, 1, 200) > 0){
+						Serve();
+					}
+				}
+				else {
+					boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+					if (Now() >= next){
+						WriteFile();
+						next += m_period;
+					}
+				}
+			}
+		}
+		
+		/* Writes a snapshot to a client and hangs up */
+		void Serve()
+		{
+			int client = accept(m_listener, 0, 0);
+			if (client < 0){
+				return;
+			}
+			std::string snapshot = Snapshot();
+			for (size_t done = 0; done < snapshot.size(); ){
+				ssize_t wrote = send(client, snapshot.data() + done, snapshot.size() - done, MSG_NOSIGNAL);
+				if (wrote <= 0){
+					break;
+				}
+				done += wrote;
+			}
+			close(client);
+		}
+		
+		/* Replaces the file with a snapshot (by renaming, so a reader never sees half of one) */
+		void WriteFile()
+		{
+			std::string temporary = m_file + ".tmp";
+			FILE *file = fopen(temporary.c_str(), "w");
+			if (!file){
+				return;
+			}
+			std::string snapshot = Snapshot();
+			bool ok = (fwrite(snapshot.data(), 1, snapshot.size(), file) == snapshot.size());
+			ok = (fclose(file) == 0) && ok;
+			if (!ok || (rename(temporary.c_str(), m_file.c_str()) < 0)){
+				unlink(temporary.c_str());
+			}
+		}
+		
+		static void Header(std::string &out, const char *name, const char *type, const char *help)
+		{
+			Line(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+		}
+		
+		static void Line(std::string &out, const char *format, ...)
+		{
+			char line[512];
+			va_list args;
+			va_start(args, format);
+			vsnprintf(line, sizeof(line), format, args);
+			va_end(args);
+			out += line;
+		}
+		
+		boost::atomic<uint64_t> m_spectra;
+		boost::atomic<uint64_t> m_overflows;
+		uint64_t m_hops;
+		uint64_t m_retried;
+		uint64_t m_retunes;
+		double m_retune_total;
+		double m_retune_max;
+		uint64_t m_last_spectra;
+		double m_last_time;
+		double m_period;
+		std::string m_file;
+		std::string m_socket;
+		int m_listener;
+		boost::atomic<bool> m_stop;
+		bool m_enabled;
+		boost::mutex m_mutex; //guards everything but the atomics
+		std::vector<Stage> m_stages;
+		detection_worker_sptr m_worker;
+		boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<Metrics> metrics_sptr;
+
+#endif
@@ -0,0 +1,334 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef REPLAY_SOURCE_HPP
+#define REPLAY_SOURCE_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <pmt/pmt.h>
+#include "tuner.hpp"
+
+/*
+ * Plays back IQ captures in place of a radio. The index file lists one capture per line:
+ *
+ *	<centre frequency in Hz> <capture file>
+ *
+ * Captures ending in .cu8 are unsigned 8 bit IQ (as written by rtl_sdr), anything else is
+ * treated as complex float (cf32). Relative paths are relative to the index file, and blank
+ * lines or lines starting with # are ignored. Retuning switches to the capture nearest the
+ * requested frequency, which is played from its start (tagged rx_freq) and looped for as long
+ * as we stay there. A line "tune-time SECONDS" makes every retune take that long, playing on
+ * from the old capture meanwhile, like the radio the captures came from would.
+ * The output is complex float, or unsigned 8 bit IQ pairs if output is CU8 (so an RTL capture goes
+ * through untouched, and a cf32 one is turned to 8 bits like an RTL dongle would have).
+ * Nothing throttles the output, so a scan runs as fast as the CPU allows.
+ */
+class replay_source : public gr::sync_block, public Tuner
+{
+	public:
+		enum Format {
+			CF32,
+			CU8
+		};
+		
+		replay_source(const std::string &index, Format output) :
+			gr::sync_block ("replay_source",
+				gr::io_signature::make (0, 0, 0),
+				gr::io_signature::make (1, 1, (output == CU8) ? 2 : sizeof (gr_complex))),
+			m_output(output), //what we play captures back as
+			m_current(-1), //we're not tuned to anything yet
+			m_position(0), //sample within the current capture
+			m_retuned(false), //whether the next sample needs an rx_freq tag
+			m_tune_time(0.0), //seconds each retune takes
+			m_rx_freq(pmt::string_to_symbol("rx_freq"))
+		{
+			if (!index.empty()){
+				LoadIndex(index);
+			}
+		}
+		
+		virtual ~replay_source()
+		{
+			BOOST_FOREACH (Segment &segment, m_segments){
+				if (segment.map){
+					munmap(segment.map, segment.bytes);
+				}
+			}
+		}
+		
+		/* Adds a capture held in memory (which must outlive us) */
+		void AddSegment(double freq, const void *data, size_t bytes, Format format)
+		{
+			Segment segment;
+			segment.freq = freq;
+			segment.data = (const unsigned char *)data;
+			segment.bytes = bytes;
+			segment.format = format;
+			segment.map = 0;
+			AddSegment(segment);
+		}
+		
+		virtual double set_center_freq(double freq)
+		{
+			if (m_tune_time > 0.0){
+				boost::this_thread::sleep(boost::posix_time::microseconds((long)(m_tune_time * 1e6)));
+			}
+			
+			gr::thread::scoped_lock lock(m_mutex);
+			if (m_freqs.empty()){
+				return 0.0; //nothing to tune to
+			}
+			
+			/* pick the nearest capture, like a radio that can't quite make the frequency */
+			std::map<double, size_t>::iterator above = m_freqs.lower_bound(freq);
+			std::map<double, size_t>::iterator nearest = above;
+			if (above == m_freqs.end()){
+				nearest--;
+			}
+			else if (above != m_freqs.begin()){
+				std::map<double, size_t>::iterator below = above;
+				below--;
+				if (freq - below->first < above->first - freq){
+					nearest = below;
+				}
+			}
+			
+			m_current = nearest->second;
+			m_position = 0;
+			m_retuned = true;
+			return nearest->first;
+		}
+		
+		/* The gain was fixed when the captures were made, so there's nothing to change */
+		virtual double set_gain(double gain)
+		{
+			return gain;
+		}
+		
+	private:
+		struct Segment {
+			double freq;
+			const unsigned char *data;
+			size_t bytes;
+			Format format;
+			void *map; //non-zero if we mapped the capture ourselves
+		};
+		
+		virtual int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+		{
+			gr::thread::scoped_lock lock(m_mutex);
+			if (m_current < 0){ //not tuned yet, so there's nothing to hear
+				if (m_output == CU8){
+					memset(output_items[0], 128, noutput_items * 2);
+				}
+				else {
+					std::fill((gr_complex *)output_items[0], (gr_complex *)output_items[0] + noutput_items, gr_complex(0.0, 0.0));
+				}
+				return noutput_items;
+			}
+			
+			const Segment &segment = m_segments[m_current];
+			if (m_retuned){ //mark where the new frequency starts, like a UHD source would
+				add_item_tag(0, nitems_written(0), m_rx_freq, pmt::from_double(segment.freq));
+				m_retuned = false;
+			}
+			
+			size_t length = Samples(segment);
+			for (int i = 0; i < noutput_items; ){
+				size_t count = std::min((size_t)(noutput_items - i), length - m_position); //copy up to the end of the capture
+				if (m_output == CU8){
+					Copy((unsigned char *)output_items[0] + i * 2, segment, count);
+				}
+				else {
+					Copy((gr_complex *)output_items[0] + i, segment, count);
+				}
+				
+				i += count;
+				m_position += count;
+				if (m_position == length){ //loop the capture
+					m_position = 0;
+				}
+			}
+			return noutput_items;
+		}
+		
+		/* Plays count samples from the current position as complex floats */
+		void Copy(gr_complex *out, const Segment &segment, size_t count)
+		{
+			if (segment.format == CU8){
+				const unsigned char *in = segment.data + m_position * 2;
+				for (size_t j = 0; j < count; j++){
+					out[j] = gr_complex((in[2*j] - 127.5f) / 127.5f, (in[2*j + 1] - 127.5f) / 127.5f);
+				}
+			}
+			else {
+				memcpy(out, segment.data + m_position * sizeof(gr_complex), count * sizeof(gr_complex));
+			}
+		}
+		
+		/* Same again as unsigned 8 bit IQ */
+		void Copy(unsigned char *out, const Segment &segment, size_t count)
+		{
+			if (segment.format == CU8){
+				memcpy(out, segment.data + m_position * 2, count * 2);
+			}
+			else {
+				const float *in = (const float *)(segment.data + m_position * sizeof(gr_complex));
+				for (size_t j = 0; j < 2 * count; j++){
+					out[j] = (unsigned char)std::max(0.0f, std::min(255.0f, in[j] * 127.5f + 128.0f)); //the nearest of the 256 levels
+				}
+			}
+		}
+		
+		void LoadIndex(const std::string &index)
+		{
+			FILE *file = fopen(index.c_str(), "r");
+			if (!file){
+				throw std::runtime_error("replay_source: can't open index " + index);
+			}
+			
+			std::string directory;
+			if (index.find('/') != std::string::npos){
+				directory = index.substr(0, index.rfind('/') + 1);
+			}
+			
+			char line[4096];
+			while (fgets(line, sizeof(line), file)){
+				double freq;
+				char path[4096];
+				if (sscanf(line, "tune-time %lf", &m_tune_time) == 1){
+					continue;
+				}
+				if ((line[0] == '#') || (sscanf(line, "%lf %4095s", &freq, path) != 2)){
+					continue; //comment or blank line
+				}
+				
+				std::string name = path;
+				if (name[0] != '/'){
+					name = directory + name;
+				}
+				
+				Format format = CF32;
+				if ((name.size() > 4) && (name.compare(name.size() - 4, 4, ".cu8") == 0)){
+					format = CU8;
+				}
+				MapSegment(freq, name, format);
+			}
+			fclose(file);
+			
+			if (m_segments.empty()){
+				throw std::runtime_error("replay_source: no captures listed in " + index);
+			}
+		}
+		
+		void MapSegment(double freq, const std::string &name, Format format)
+		{
+			int fd = open(name.c_str(), O_RDONLY);
+			if (fd < 0){
+				throw std::runtime_error("replay_source: can't open capture " + name);
+			}
+			
+			struct stat st;
+			if ((fstat(fd, &st) < 0) || (st.st_size == 0)){
+				close(fd);
+				throw std::runtime_error("replay_source: empty capture " + name);
+			}
+			
+			Segment segment;
+			segment.freq = freq;
+			segment.bytes = st.st_size;
+			segment.format = format;
+			segment.map = mmap(0, segment.bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (segment.map == MAP_FAILED){ //can't map it (a pipe, perhaps), so read it in instead
+				segment.map = 0;
+				m_owned.push_back(std::vector<unsigned char>(segment.bytes));
+				std::vector<unsigned char> &buffer = m_owned.back();
+				size_t done = 0;
+				while (done < segment.bytes){
+					ssize_t got = read(fd, &buffer[done], segment.bytes - done);
+					if (got <= 0){
+						close(fd);
+						throw std::runtime_error("replay_source: can't read capture " + name);
+					}
+					done += got;
+				}
+				segment.data = &buffer[0];
+			}
+			else {
+				madvise(segment.map, segment.bytes, MADV_SEQUENTIAL);
+				segment.data = (const unsigned char *)segment.map;
+			}
+			close(fd);
+			AddSegment(segment);
+		}
+		
+		void AddSegment(const Segment &segment)
+		{
+			if (Samples(segment) == 0){
+				throw std::runtime_error("replay_source: capture shorter than one sample");
+			}
+			
+			gr::thread::scoped_lock lock(m_mutex);
+			m_freqs[segment.freq] = m_segments.size();
+			m_segments.push_back(segment);
+		}
+		
+		size_t Samples(const Segment &segment)
+		{
+			return segment.bytes / ((segment.format == CU8) ? 2 : sizeof(gr_complex));
+		}
+		
+		gr::thread::mutex m_mutex; //retunes come from the sink's thread
+		std::vector<Segment> m_segments;
+		std::list<std::vector<unsigned char> > m_owned; //captures we had to read rather than map
+		std::map<double, size_t> m_freqs; //segment index by centre frequency
+		Format m_output;
+		int m_current;
+		size_t m_position;
+		bool m_retuned;
+		double m_tune_time;
+		pmt::pmt_t m_rx_freq;
+};
+
+/* Shared pointer thing gnuradio is fond of */
+typedef boost::shared_ptr<replay_source> replay_source_sptr;
+replay_source_sptr make_replay_source(const std::string &index, replay_source::Format output)
+{
+	return boost::shared_ptr<replay_source>(new replay_source(index, output));
+}
+
+#endif
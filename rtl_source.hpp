@@ -0,0 +1,276 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef RTL_SOURCE_HPP
+#define RTL_SOURCE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <pmt/pmt.h>
+#include <rtl-sdr.h>
+#include "tuner.hpp"
+
+/*
+ * An RTL dongle read straight through librtlsdr, giving the unsigned 8 bit IQ pairs it sends rather
+ * than the complex floats the OsmoSDR source turns them into (4 times the bytes to move about). The
+ * device is picked with the same rtl=INDEX or rtl=SERIAL as the OsmoSDR source (the first dongle if
+ * it isn't given), and set up the same way: no frequency correction, 10 dB of manual gain and 20 dB
+ * of IF gain (which only E4000 tuners have). librtlsdr's own thread fills a ring of buffers which
+ * work empties; if work falls behind, the newest samples are dropped and an O printed, as the
+ * OsmoSDR source does. Like a UHD source, the first sample is tagged rx_time, and so is the first after
+ * every drop (with the host's time it arrived, as the dongle doesn't keep one), so the sink can tell
+ * there's a gap. The first sample to arrive after a retune is tagged rx_freq.
+ */
+class rtl_source : public gr::sync_block, public Tuner
+{
+	public:
+		rtl_source(const std::string &device, double sample_rate) :
+			gr::sync_block ("rtl_source",
+				gr::io_signature::make (0, 0, 0),
+				gr::io_signature::make (1, 1, 2)),
+			m_device(0),
+			m_ring(s_buffers * s_buffer_size), //nearly 2 seconds at 2.4 MS/s
+			m_head(0), //next byte librtlsdr fills
+			m_used(0), //bytes waiting for work
+			m_received(0), //bytes put in the ring altogether
+			m_retuned(false), //whether there's an rx_freq tag to add
+			m_tag_at(0), //the byte it goes on (counting like m_received)
+			m_freq(0.0),
+			m_rx_freq(pmt::string_to_symbol("rx_freq")),
+			m_dropped(true), //whether the next buffer stored needs an rx_time tag (as it starts the stream)
+			m_rx_time(pmt::string_to_symbol("rx_time")),
+			m_stop(false)
+		{
+			int index = Index(device);
+			if ((index < 0) || (rtlsdr_open(&m_device, index) < 0)){
+				throw std::runtime_error("rtl_source: can't open RTL device " + device);
+			}
+			rtlsdr_set_sample_rate(m_device, (uint32_t)sample_rate);
+			rtlsdr_set_tuner_gain_mode(m_device, 1); //manual
+			rtlsdr_set_tuner_gain(m_device, 100); //tenths of a dB (the tuner picks the nearest it has)
+			SetIfGain(20.0);
+			rtlsdr_reset_buffer(m_device);
+			m_thread = boost::thread(&rtl_source::Read, this);
+		}
+		
+		virtual ~rtl_source()
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				m_stop = true;
+			}
+			while (!m_thread.timed_join(boost::posix_time::milliseconds(100))){ //cancelling does nothing until the read has started, so keep at it
+				rtlsdr_cancel_async(m_device);
+			}
+			rtlsdr_close(m_device);
+		}
+		
+		virtual double set_center_freq(double freq)
+		{
+			rtlsdr_set_center_freq(m_device, (uint32_t)freq);
+			double actual = rtlsdr_get_center_freq(m_device);
+			
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_retuned = true;
+			m_tag_at = m_received; //samples already here are from before
+			m_freq = actual;
+			return actual;
+		}
+		
+		virtual double set_gain(double gain)
+		{
+			rtlsdr_set_tuner_gain(m_device, (int)(gain * 10.0 + 0.5)); //the nearest the tuner has
+			return rtlsdr_get_tuner_gain(m_device) / 10.0;
+		}
+		
+	private:
+		static const size_t s_buffers = 32;
+		static const size_t s_buffer_size = 16 * 16384; //bytes in each of librtlsdr's transfers
+		
+		/* Works out which dongle is meant from OsmoSDR style arguments */
+		static int Index(const std::string &device)
+		{
+			size_t at = device.find("rtl=");
+			if (at == std::string::npos){
+				return (rtlsdr_get_device_count() > 0) ? 0 : -1;
+			}
+			std::string id = device.substr(at + 4, device.find(',', at) - (at + 4));
+			char *end;
+			long index = strtol(id.c_str(), &end, 10);
+			if (!id.empty() && (*end == 0)){
+				return index;
+			}
+			return rtlsdr_get_index_by_serial(id.c_str());
+		}
+		
+		/* Spreads gain dB over an E4000's six IF stages as the OsmoSDR source does, setting each in turn (last first) to get as close as it can with the rest as they are */
+		void SetIfGain(double gain)
+		{
+			if (rtlsdr_get_tuner_type(m_device) != RTLSDR_TUNER_E4000){ //the others have no IF gain to set
+				return;
+			}
+			static const double start[6] = {-3.0, 0.0, 0.0, 0.0, 3.0, 3.0}; //dB
+			static const double stop[6] = {6.0, 9.0, 9.0, 2.0, 15.0, 15.0};
+			static const double step[6] = {9.0, 3.0, 3.0, 1.0, 3.0, 3.0};
+			double stages[6];
+			std::copy(start, start + 6, stages);
+			
+			for (int i = 5; i >= 0; i--){
+				double error = gain;
+				for (double g = start[i]; g <= stop[i]; g += step[i]){
+					double sum = g;
+					for (int j = 0; j < 6; j++){
+						sum += (j == i) ? 0.0 : stages[j];
+					}
+					if (std::fabs(gain - sum) < error){
+						error = std::fabs(gain - sum);
+						stages[i] = g;
+					}
+				}
+			}
+			for (int i = 0; i < 6; i++){
+				rtlsdr_set_tuner_if_gain(m_device, i + 1, (int)(stages[i] * 10.0)); //tenths of a dB
+			}
+		}
+		
+		void Read()
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				if (m_stop){ //gone before we started
+					return;
+				}
+			}
+			rtlsdr_read_async(m_device, &rtl_source::Callback, this, 15, s_buffer_size);
+		}
+		
+		static void Callback(unsigned char *buffer, uint32_t length, void *context)
+		{
+			((rtl_source *)context)->Store(buffer, length);
+		}
+		
+		void Store(const unsigned char *buffer, size_t length)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (m_stop){ //in case the destructor's cancel came before the read started
+				rtlsdr_cancel_async(m_device);
+				return;
+			}
+			if (m_used + length > m_ring.size()){ //work has fallen behind
+				fputc('O', stderr);
+				m_dropped = true;
+				return;
+			}
+			if (m_dropped){ //tag the first sample after the gap
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				m_gaps.push_back(std::make_pair(m_received, now));
+				m_dropped = false;
+			}
+			for (size_t done = 0; done < length; ){
+				size_t count = std::min(length - done, m_ring.size() - m_head); //up to the end of the ring
+				memcpy(&m_ring[m_head], buffer + done, count);
+				m_head = (m_head + count) % m_ring.size();
+				done += count;
+			}
+			m_used += length;
+			m_received += length;
+			m_ready.notify_one();
+		}
+		
+		virtual int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+		{
+			unsigned char *out = (unsigned char *)output_items[0];
+			
+			boost::mutex::scoped_lock lock(m_mutex);
+			while (!m_stop && (m_used < 2)){
+				m_ready.timed_wait(lock, boost::posix_time::milliseconds(100));
+			}
+			if (m_stop){
+				return WORK_DONE;
+			}
+			
+			size_t length = std::min((size_t)noutput_items * 2, m_used & ~(size_t)1); //whole samples only
+			size_t tail = (m_head + m_ring.size() - m_used) % m_ring.size();
+			for (size_t done = 0; done < length; ){
+				size_t count = std::min(length - done, m_ring.size() - tail);
+				memcpy(out + done, &m_ring[tail], count);
+				tail = (tail + count) % m_ring.size();
+				done += count;
+			}
+			m_used -= length;
+			
+			uint64_t taken = m_received - m_used; //bytes handed out, counting these
+			uint64_t first = taken - length; //the byte these started at
+			if (m_retuned && (m_tag_at < taken)){ //the first sample since the retune is in this lot
+				add_item_tag(0, nitems_written(0) + (std::max(m_tag_at, first) - first) / 2, m_rx_freq, pmt::from_double(m_freq));
+				m_retuned = false;
+			}
+			size_t gaps = 0;
+			for (; (gaps < m_gaps.size()) && (m_gaps[gaps].first < taken); gaps++){
+				const struct timespec &when = m_gaps[gaps].second;
+				add_item_tag(0, nitems_written(0) + (std::max(m_gaps[gaps].first, first) - first) / 2, m_rx_time,
+					pmt::make_tuple(pmt::from_uint64(when.tv_sec), pmt::from_double(when.tv_nsec / 1e9)));
+			}
+			m_gaps.erase(m_gaps.begin(), m_gaps.begin() + gaps);
+			return length / 2;
+		}
+		
+		rtlsdr_dev_t *m_device;
+		boost::mutex m_mutex;
+		boost::condition_variable m_ready;
+		std::vector<unsigned char> m_ring;
+		size_t m_head;
+		size_t m_used;
+		uint64_t m_received;
+		bool m_retuned;
+		uint64_t m_tag_at;
+		double m_freq;
+		pmt::pmt_t m_rx_freq;
+		bool m_dropped;
+		std::vector<std::pair<uint64_t, struct timespec> > m_gaps; //rx_time tags to add: the byte each goes on (counting like m_received) and when it arrived
+		pmt::pmt_t m_rx_time;
+		bool m_stop;
+		boost::thread m_thread;
+};
+
+/* Shared pointer thing gnuradio is fond of */
+typedef boost::shared_ptr<rtl_source> rtl_source_sptr;
+rtl_source_sptr make_rtl_source(const std::string &device, double sample_rate)
+{
+	return boost::shared_ptr<rtl_source>(new rtl_source(device, sample_rate));
+}
+
+#endif
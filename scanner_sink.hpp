@@ -16,54 +16,149 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
 */
 
-#include <ctime>
-#include <set>
-#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
 
 #include <boost/shared_ptr.hpp>
 
 #include <gnuradio/block.h>
 #include <gnuradio/io_signature.h>
-#include <osmosdr/source.h>
+#include <pmt/pmt.h>
+#include "arena.hpp"
+#include "control.hpp"
+#include "detection_worker.hpp"
+#include "kernels.hpp"
+#include "metrics.hpp"
+#include "sweep_plan.hpp"
+#include "tuner.hpp"
 
 
 class scanner_sink : public gr::block
 {
 	public:
-		scanner_sink(osmosdr::source::sptr source, unsigned int vector_length, double centre_freq_1, double centre_freq_2, double bandwidth0, double bandwidth1, double bandwidth2,
-				double step, unsigned int avg_size, double spread, double threshold, double ptime) :
+		scanner_sink(tuner_sptr source, detection_worker_sptr worker, sweep_plan_sptr plan, metrics_sptr metrics, control_sptr control, unsigned int device,
+				unsigned int vector_length, unsigned int hop, double bandwidth0, unsigned int avg_size, double ptime, unsigned int settle, bool use_tags,
+				bool adaptive) :
 			gr::block ("scanner_sink",
 				gr::io_signature::make (1, 1, sizeof (float) * vector_length),
 				gr::io_signature::make (0, 0, 0)),
-			m_source(source), //We need the source in order to be able to control it
-			m_buffer(new float[vector_length]), //buffer into which we accumulate the total for averaging
+			m_retuner(new Retuner(source)), //We need the source in order to be able to control it (which we do on another thread)
+			m_worker(worker), //finds and reports the signals on its own thread
+			m_plan(plan), //tells us which frequency to move to next
+			m_metrics(metrics), //counts what we get up to
+			m_control(control), //where changes to the settings come from, if anywhere
+			m_version(0), //of the control's settings, as we have them
+			m_gain(NAN), //what we last set the gain to (NaN if we've left it as it was)
+			m_device(device), //our number in the plan
+			m_arena(Arena::Size<float>(vector_length)),
+			m_buffer(m_arena.Take<float>(vector_length)), //buffer into which we accumulate the total for averaging
 			m_vector_length(vector_length), //size of the FFT
+			m_hop(hop), //samples between the starts of the FFTs (less than the FFT if they overlap)
 			m_count(0), //number of FFTs totalled in the buffer
 			m_wait_count(0), //number of times we've listenned on this frequency
+			m_idle(false), //whether we're waiting for the other devices to finish the pass
+			m_pass(0), //the pass we're on
 			m_avg_size(avg_size), //the number of FFTs we should average over
-			m_step(step), //the amount by which the frequency shold be incremented
-			m_centre_freq_1(centre_freq_1), //start frequency (and then current frequency)
-			m_centre_freq_2(centre_freq_2), //end frequency
+			m_adaptive(adaptive), //whether to stop averaging once we're sure what's there, and report back to the plan
+			m_check(std::max(avg_size / 8, 1u)), //FFTs to sum before first asking detection whether we're sure yet
+			m_next_check(0), //FFTs in the sum when we next ask
+			m_dwell(1), //spectra to listen for on this frequency
+			m_step(0), //which of the plan's steps it is
+			m_sum(0), //sums started so far (so late answers about old ones can be told apart)
+			m_signals(0), //most signals detection's said are here so far
+			m_final_step(0), //the step the last sum detection's checking for the plan was on
+			m_final_pass(0),
+			m_final_signals(0),
+			m_centre_freq(0.0), //current frequency
+			m_freq(0.0), //frequency we're retuning to
+			m_attempts(0), //retunes it's taken to get to the next frequency so far
+			m_retuning(false), //whether the retuner's still busy getting there
 			m_bandwidth0(bandwidth0), //samples per second
-			m_bandwidth1(bandwidth1), //fine window (band)width
-			m_bandwidth2(bandwidth2), //coarse window (band)width
-			m_threshold(threshold), //threshold in dB for discovery
-			m_spread(spread), //minumum distance between radio signals (overlapping scans might produce slightly different frequencies)
 			m_time(ptime), //the amount of time to listen on the same frequency for
-			m_start_time(time(0)) //the start time of the scan (useful for logging/reporting/monitoring)
+			m_settle((settle + vector_length - 1) / hop), //FFTs to drop once a retune has taken effect (rounded up, and counting the ones that still overlap it)
+			m_use_tags(use_tags), //whether to wait for the source's rx_freq tag to know when a retune has taken effect
+			m_tuned(0.0), //the frequency the source says it's on
+			m_waiting_tag(false), //whether we're still waiting for the rx_freq tag
+			m_tag_freq(NAN), //frequency of the last rx_freq tag while retuning
+			m_tag_offset(0), //and the FFT it was on
+			m_settling(0), //FFTs still to drop
+			m_discarded(0), //FFTs dropped since the last retune
+			m_discarded_total(0),
+			m_discarded_max(0),
+			m_hops(0),
+			m_started(0.0), //when we first got some FFTs
+			m_rx_freq(pmt::string_to_symbol("rx_freq")),
+			m_rx_time(pmt::string_to_symbol("rx_time")),
+			m_streaming(false) //whether we've seen the rx_time tag a source starts with
 		{
+			m_partial.state.store(SettleCheck::IDLE);
+			m_final.state.store(SettleCheck::IDLE);
 			ZeroBuffer();
+			NextStep(); //start getting onto our first frequency before the flowgraph starts
 		}
 		
-		virtual ~scanner_sink()
+		/* Asks every sink to finish at its next FFT (safe to call from a signal handler) */
+		static void Stop()
 		{
-			delete []m_buffer; //delete the buffer
+			s_stop = 1;
+		}
+		
+		static bool Stopped()
+		{
+			return s_stop;
 		}
 		
 	private:
 		virtual int general_work(int noutput_items, gr_vector_int &ninput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
 		{
+			if (m_started == 0.0){
+				m_started = Now();
+			}
+			if (m_use_tags){
+				get_tags_in_range(m_tags, 0, nitems_read(0), nitems_read(0) + ninput_items[0], m_rx_freq);
+				m_next_tag = 0;
+			}
+			get_tags_in_range(m_time_tags, 0, nitems_read(0), nitems_read(0) + ninput_items[0], m_rx_time);
+			m_next_time_tag = 0;
+			
+			if (m_adaptive){
+				CheckFinal();
+			}
+			
 			for (int i = 0; i < ninput_items[0]; i++){
+				if (s_stop || m_plan->Finished()){ //interrupted (so drop the pass we're part way through), or all done
+					Finish();
+					return WORK_DONE;
+				}
+				if (Gap(nitems_read(0) + i) && (m_count > 0)){ //the sum so far is from before samples were lost, and this FFT spans the gap
+					m_count = 0;
+					m_sum++; //so a check on the old sum isn't taken for this one
+					ZeroBuffer();
+					continue;
+				}
+				if (m_idle){ //nothing for us to do until the next pass starts
+					if ((m_plan->Pass() != m_pass) && !m_plan->Waiting(Now())){
+						m_pass = m_plan->Pass();
+						m_idle = false;
+						NextStep();
+					}
+					continue;
+				}
+				if (m_retuning){
+					CatchUpTags(nitems_read(0) + i); //the source may say it's there before we hear the retune's done
+					if (!Tuned(nitems_read(0) + i)){ //the radio's still on its way (or there was nowhere left to go), so this FFT's from before
+						m_discarded++;
+						continue;
+					}
+				}
+				if (Settling(nitems_read(0) + i)){ //this FFT may still hold samples from before the retune
+					m_discarded++;
+					continue;
+				}
 				ProcessVector(((float *)input_items[0]) + i * m_vector_length);
 			}
 			
@@ -71,194 +166,322 @@ class scanner_sink : public gr::block
 			return 0;
 		}
 		
-		void ProcessVector(float *input)
+		/* Works out whether the FFT at offset should be dropped because the source hasn't settled on m_tuned yet */
+		bool Settling(uint64_t offset)
+		{
+			if (m_waiting_tag){
+				for (; (m_next_tag < m_tags.size()) && (m_tags[m_next_tag].offset <= offset); m_next_tag++){
+					double freq = pmt::to_double(m_tags[m_next_tag].value);
+					if ((freq - m_tuned < 10.0) && (m_tuned - freq < 10.0)){ //the retune has taken effect in this FFT
+						m_waiting_tag = false;
+						m_settling = m_settle + 1; //the tagged FFT itself is probably part stale
+					}
+				}
+				
+				if (m_waiting_tag && (m_discarded >= m_avg_size * 10)){ //we've waited long enough for this to be a source that never tags
+					fprintf(stderr, "[-] No rx_freq tag from the source, dropping %u FFTs after each retune instead\n", m_settle);
+					m_use_tags = false;
+					m_waiting_tag = false;
+				}
+			}
+			
+			if (m_waiting_tag){
+				return true;
+			}
+			if (m_settling > 0){
+				m_settling--;
+				return true;
+			}
+			return false;
+		}
+		
+		/* Whether the source dropped samples just before the FFT at offset (a source that tags rx_time does so when it starts, and again after each drop) */
+		bool Gap(uint64_t offset)
 		{
-			//Add the FFT to the total
-			for (unsigned int i = 0; i < m_vector_length; i++){
-				m_buffer[i] += input[i];
+			bool gap = false;
+			for (; (m_next_time_tag < m_time_tags.size()) && (m_time_tags[m_next_time_tag].offset <= offset); m_next_time_tag++){
+				if (m_streaming){
+					m_metrics->CountOverflow();
+					gap = true;
+				}
+				m_streaming = true;
 			}
+			return gap;
+		}
+		
+		/* Notes the last rx_freq tag up to the FFT at offset, while we don't know where the retune will end up */
+		void CatchUpTags(uint64_t offset)
+		{
+			for (; m_use_tags && (m_next_tag < m_tags.size()) && (m_tags[m_next_tag].offset <= offset); m_next_tag++){
+				m_tag_freq = pmt::to_double(m_tags[m_next_tag].value);
+				m_tag_offset = m_tags[m_next_tag].offset;
+			}
+		}
+		
+		void ProcessVector(float *input)
+		{
+			Kernels::AccumulateShifted(m_buffer, input, m_vector_length); //add the FFT to the total (which is kept with 0 Hz in the middle)
 			m_count++; //increment the total
 			
-			if (m_avg_size == m_count){ //we've averaged over the number we intended to
-				double freqs[m_vector_length]; //for convenience
-				float bands0[m_vector_length]; //bands in order of frequency
-				float bands1[m_vector_length]; //fine window bands
-				float bands2[m_vector_length]; //coarse window bands
+			bool done = (m_avg_size == m_count); //we've averaged over the number we intended to
+			bool settled = false;
+			if (m_adaptive && !done){ //or detection might be sure enough what's there already
+				done = settled = CheckPartial();
+			}
+			
+			if (done){
+				m_wait_count++; //we've just done another listen
+				bool move = (std::max(m_time/(m_bandwidth0/(double)(m_hop * m_avg_size)), 1.0) * m_dwell <= m_wait_count); //if we should move to the next frequency
+				SettleCheck *check = 0;
+				if (m_adaptive && move){ //tell the plan what this frequency was like, now if we know or once detection's looked at the whole sum
+					if (settled || (m_final.state.load(boost::memory_order_acquire) != SettleCheck::IDLE)){ //sure, or detection's too far behind to wait for
+						m_plan->Record(m_step, m_pass, m_signals, settled);
+					}
+					else {
+						m_final_step = m_step;
+						m_final_pass = m_pass;
+						m_final_signals = m_signals;
+						check = &m_final;
+					}
+				}
+				bool moving = move && Retune(); //get the radio going first, so it retunes while we hand the spectrum over and carry on through the FFTs
 				
-				Rearrange(bands0, freqs, m_centre_freq_1, m_bandwidth0); //organise the buffer into a convenient order (saves to bands0)
-				GetBands(bands0, bands1, m_bandwidth1); //apply the fine window (saves to bands1)
-				GetBands(bands0, bands2, m_bandwidth2); //apply the coarse window (saves to bands2)
-				PrintSignals(freqs, bands1, bands2);
+				m_worker->Submit(m_device, m_buffer, m_count, m_centre_freq, Now(), m_discarded * m_hop, check); //hand the spectrum over for detection
+				m_metrics->CountSpectrum();
+				if (m_wait_count == 1){ //first spectrum on this frequency, so account for what we dropped getting here
+					m_hops++;
+					m_discarded_total += m_discarded;
+					m_discarded_max = std::max(m_discarded_max, m_discarded);
+				}
+				m_discarded = 0;
 				
 				m_count = 0; //next time, we're starting from scratch - so note this
+				m_sum++;
 				ZeroBuffer(); //get ready to start again
 				
-				m_wait_count++; //we've just done another listen
-				if (m_time/(m_bandwidth0/(double)(m_vector_length * m_avg_size)) <= m_wait_count){ //if we should move to the next frequency
-					while (true) { //keep moving to the next frequency until we get to one we can listen on (copes with holes in the tunable range)
-						if (m_centre_freq_2 <= m_centre_freq_1){ //we reached the end!
-							//do something to end the scan
-							fprintf(stderr, "[*] Finished scanning\n"); //say we're exiting
-							exit(0); //TODO: This probably isn't the right thing, but it'll do for now
-						}
-						
-						m_centre_freq_1 += m_step; //calculate the frequency we should change to
-						double actual = m_source->set_center_freq(m_centre_freq_1); //change frequency
-						if ((m_centre_freq_1 - actual < 10.0) && (actual - m_centre_freq_1 < 10.0)){ //success
-							break; //so stop changing frequency
-						}
-					}
-					m_wait_count = 0; //new frequency - we've listenned 0 times on it
+				if (move && !moving){ //nowhere left to go this pass
+					Idle();
 				}
 			}
 		}
 		
-		void PrintSignals(double *freqs, float *bands1, float *bands2)
+		/*
+		 * Asks detection whether the sum so far is enough to decide what's in it, without waiting for the answer, returning true once it's said
+		 * so. It first asks once the sum is both m_check FFTs and big enough that it could be, then each time the sum's doubled since it last
+		 * asked (as the margin only shrinks with the square root of the count, asking more often than that rarely settles any sooner).
+		 */
+		bool CheckPartial()
 		{
-			/* Calculate the current time after start */
-			unsigned int t = time(0) - m_start_time;
-			unsigned int hours = t / 3600;
-			unsigned int minutes = (t % 3600) / 60;
-			unsigned int seconds = t % 60;
-			
-			//Print that we finished scanning something
-			fprintf(stderr, "%02u:%02u:%02u: Finished scanning %f MHz - %f MHz\n",
-				hours, minutes, seconds, (m_centre_freq_1 - m_bandwidth0/2.0)/1000000.0, (m_centre_freq_1 + m_bandwidth0/2.0)/1000000.0);
-			
-			/* Calculate the differences between the fine and coarse window bands */
-			float diffs[m_vector_length];
-			for (unsigned int i = 0; i < m_vector_length; i++){
-				diffs[i] = bands1[i] - bands2[i];
+			if (m_count == 1){ //a new sum
+				m_next_check = std::max(m_check, m_worker->SettleCount());
 			}
-			
-			/* Look through to find signals */
-			//start with no signal found (note: diffs[0] should always be very negative because of the way the windowing function works)
-			bool sig = false;
-			unsigned int peak = 0;
-			for (unsigned int i = 0; i < m_vector_length; i++){
-				if (sig){ //we're already in a signal
-					if (diffs[peak] < diffs[i]){ //we found a rough end to the signal
-						peak = i;
-					}
-					
-					if (diffs[i] < m_threshold){ //we're transitionning to the end
-						/* look for the "start" of the signal */
-						unsigned int min = peak; //scan outwards for the minimum
-						while ((diffs[min] > diffs[peak] - 3.0) && (min > 0)){ //while the signal is still more than half power
-							min--;
-						}
-						
-						/* look for the "end" */
-						unsigned int max = peak;
-						while ((diffs[max] > diffs[peak] - 3.0) && (max < m_vector_length - 1)){
-							max++;
-						}
-						sig = false; //we're now in no signal state
-						
-						/* Print the signal if it's a genuine hit */
-						if (TrySignal(freqs[max], freqs[min])){
-							printf("[+] %02u:%02u:%02u: Found signal: at %f MHz of width %f kHz, peak power %f dB (difference %f dB)\n",
-								hours, minutes, seconds, (freqs[max] + freqs[min]) / 2000000.0, (freqs[max] - freqs[min])/1000.0, bands1[peak], diffs[peak]);
-						}
+			if (m_partial.state.load(boost::memory_order_acquire) == SettleCheck::ANSWERED){
+				m_partial.state.store(SettleCheck::IDLE, boost::memory_order_relaxed);
+				if (m_partial.sum == m_sum){ //not about a sum we've since finished with
+					m_signals = std::max(m_signals, m_partial.signals);
+					if (m_partial.settled){
+						return true;
 					}
 				}
-				else {
-					if (diffs[i] >= m_threshold){ //we found a signal!
-						peak = i;
-						sig = true;
-					}
+			}
+			if ((m_count >= m_next_check) && (m_partial.state.load(boost::memory_order_relaxed) == SettleCheck::IDLE)){
+				m_partial.sum = m_sum;
+				if (m_worker->Check(m_device, m_buffer, m_count, &m_partial)){ //if our queue's busy, we'll ask again at the next FFT
+					m_next_check = m_count * 2;
 				}
 			}
+			return false;
 		}
 		
+		/* Passes on to the plan what detection's made of the last sum on a frequency we've left, once it has */
+		void CheckFinal()
+		{
+			if (m_final.state.load(boost::memory_order_acquire) == SettleCheck::ANSWERED){
+				m_plan->Record(m_final_step, m_final_pass, std::max(m_final_signals, m_final.signals), m_final.settled);
+				m_final.state.store(SettleCheck::IDLE, boost::memory_order_relaxed);
+			}
+		}
 		
-		bool TrySignal(double min, double max)
+		/* Moves to the next frequency in the plan we can listen on, or goes idle if there are none left this pass */
+		void NextStep()
 		{
-			double mid = (min + max)/2.0; //calculate the midpoint of the signal
+			if (!Retune()){
+				Idle();
+			}
+		}
+		
+		/* Starts retuning to the next frequency in the plan, returning false if there are none left this pass */
+		bool Retune()
+		{
+			Control::Settings settings;
+			if (m_control && m_control->Changed(m_version, settings)){ //between hops is when changes to the settings take effect
+				Reconfigure(settings);
+			}
 			
-			/* check to see if the signal is too close to the centre frequency (a signal often erroniously appears there) */
-			if ((mid - m_centre_freq_1 < m_spread) && (m_centre_freq_1 - mid < m_spread)){
-				return false; //if so, this is not a genuine hit
+			if (!m_plan->Next(m_device, Now(), m_freq, m_dwell, m_step)){
+				return false;
+			}
+			m_attempts++;
+			m_retuner->Start(m_freq);
+			m_retuning = true;
+			m_tag_freq = NAN;
+			return true;
+		}
+		
+		/* Takes on the averaging, time and gain in settings (the retuner isn't busy, so the gain can be set straight away) */
+		void Reconfigure(const Control::Settings &settings)
+		{
+			m_avg_size = settings.avg_size;
+			m_check = std::max(m_avg_size / 8, 1u);
+			m_time = settings.ptime;
+			if ((settings.gain == settings.gain) && (settings.gain != m_gain)){
+				m_gain = settings.gain;
+				fprintf(stderr, "[*] Set the gain of device %u to %f dB\n", m_device, m_retuner->SetGain(m_gain));
+			}
+		}
+		
+		/*
+		 * Sees whether the retune has finished (without waiting) by the FFT at offset, returning true once we're on the new frequency.
+		 * If it didn't work, moves on through the plan (coping with holes in the tunable range), or goes idle if there's nowhere left to go.
+		 */
+		bool Tuned(uint64_t offset)
+		{
+			double actual, seconds;
+			if (!m_retuner->Done(actual, seconds)){
+				return false;
 			}
+			m_retuning = false;
+			m_metrics->Retuned(seconds);
 			
-			/* check to see if the signal is close to any other (the same signal often appears with a slightly different centre frequency) */
-			BOOST_FOREACH (double signal, m_signals){
-				if ((mid - signal < m_spread) && (signal - mid < m_spread)){ //tpo close
-					return false; //if so, this is not a genuine hit
+			if ((m_freq - actual < 10.0) && (actual - m_freq < 10.0)){ //success
+				m_metrics->Hopped(m_attempts);
+				m_attempts = 0;
+				m_centre_freq = m_freq;
+				m_tuned = actual;
+				m_wait_count = 0; //new frequency - we've listenned 0 times on it
+				m_signals = 0;
+				m_waiting_tag = m_use_tags; //anything already in the flowgraph is from the old frequency
+				m_settling = m_use_tags ? 0 : m_settle;
+				if (m_use_tags && (std::fabs(m_tag_freq - actual) < 10.0)){ //the source said it was there before we heard, so settle from the tag (see Settling)
+					m_waiting_tag = false;
+					m_settling = m_settle + 1 - std::min<uint64_t>(offset - m_tag_offset, m_settle + 1);
 				}
+				return true;
 			}
 			
-			/* Genuine hit!:D */
-			m_signals.insert(mid); //add to the set of signals
-			return true; //genuine hit
+			m_plan->Untunable(m_device); //don't bother with it on later passes
+			if (!Retune()){
+				m_attempts = 0;
+				Idle();
+			}
+			return false;
 		}
 		
-		void Rearrange(float *bands, double *freqs, double centre, double bandwidth)
+		/* Waits for the other devices to finish the pass, ending it if we were the last */
+		void Idle()
 		{
-			double samplewidth = bandwidth/(double)m_vector_length;
-			for (unsigned int i = 0; i < m_vector_length; i++){
-				/* FFT is arranged starting at 0 Hz at the start, rather than in the middle */
-				if (i < m_vector_length/2){ //lower half of the fft
-					bands[i + m_vector_length/2] = m_buffer[i]/(float)m_avg_size;
-				}
-				else { //upper half of the fft
-					bands[i - m_vector_length/2] = m_buffer[i]/(float)m_avg_size;
+			m_idle = true;
+			if (m_plan->Idle()){ //we were the last device still listening, so the pass is over
+				double start = NAN, end = NAN, step;
+				if (m_control && m_control->TakeRange(start, end, step)){ //everyone's waiting, so this is when the range can change
+					m_plan->SetRange(start, end, step);
+					fprintf(stderr, "[*] Sweeping %f MHz - %f MHz from the next pass\n", start/1000000.0, end/1000000.0);
 				}
-				
-				freqs[i] = centre + i * samplewidth - bandwidth/2; //calculate the frequency of this sample
+				m_worker->EndSweep(m_device, Now(), start, end);
+				m_plan->EndPass(Now());
 			}
 		}
 		
-		void GetBands(float *powers, float *bands, unsigned int bandwidth)
+		void Finish()
 		{
-			double samplewidth = m_bandwidth0/(double)m_vector_length; //the width in Hz of each sample
-			unsigned int bandwidth_samples = bandwidth/samplewidth; //the number of samples in our window
-			for (unsigned int i = 0; i < m_vector_length; i++){ //we're averaging, so start with 0
-				bands[i] = 0.0;
+			double elapsed = Now() - m_started;
+			if ((m_hops > 0) && (elapsed > 0.0)){
+				fprintf(stderr, "[*] Made %llu hops on device %u in %.2f s (%.1f per second)\n", (unsigned long long)m_hops, m_device, elapsed, m_hops / elapsed);
 			}
-			
-			for (unsigned int i = 0; i < m_vector_length; i++){ //over the entire FFT
-				 //make the buffer contains the entire window
-				if ((i >= bandwidth_samples/2) && (i < m_vector_length + bandwidth_samples/2 - bandwidth_samples)){
-					for (unsigned int j = 0; j < bandwidth_samples; j++){ //iterate over the window for averaging
-						bands[i + j - bandwidth_samples/2] += powers[i] / (float)bandwidth_samples; //add this sample to the bands
-					}
+			if (m_discarded_total > 0){
+				fprintf(stderr, "[*] Dropped %llu samples settling after retunes on device %u (%.0f per hop on average, at most %llu)\n",
+					(unsigned long long)m_discarded_total * m_hop, m_device, (double)m_discarded_total * m_hop / m_hops,
+					(unsigned long long)m_discarded_max * m_hop);
+			}
+			if (m_plan->Leave()){ //we're the last device, so nothing more will be submitted
+				if (!m_plan->Finished()){
+					fprintf(stderr, "[*] Stopped part way through pass %u\n", m_plan->Pass() + 1);
 				}
+				m_worker->Finish(); //let detection catch up
+				fprintf(stderr, "[*] Finished scanning\n"); //say we're exiting
 			}
 		}
 		
 		void ZeroBuffer()
 		{
-			/* writes zeros to m_buffer */
-			for (unsigned int i = 0; i < m_vector_length; i++){
-				m_buffer[i] = 0.0;
-			}
+			Kernels::Clear(m_buffer, m_vector_length); //writes zeros to m_buffer
 		}
 		
-		//std::set<std::pair<double, double>> m_signals;
-		std::set<double> m_signals;
-		osmosdr::source::sptr m_source;
+		retuner_sptr m_retuner;
+		detection_worker_sptr m_worker;
+		sweep_plan_sptr m_plan;
+		metrics_sptr m_metrics;
+		control_sptr m_control;
+		unsigned int m_version;
+		double m_gain;
+		unsigned int m_device;
+		Arena m_arena;
 		float *m_buffer;
 		unsigned int m_vector_length;
+		unsigned int m_hop;
 		unsigned int m_count;
 		unsigned int m_wait_count;
+		bool m_idle;
+		unsigned int m_pass;
 		unsigned int m_avg_size;
-		double m_step;
-		double m_centre_freq_1;
-		double m_centre_freq_2;
+		bool m_adaptive;
+		unsigned int m_check;
+		unsigned int m_next_check;
+		unsigned int m_dwell;
+		unsigned long m_step;
+		unsigned int m_sum;
+		unsigned int m_signals;
+		SettleCheck m_partial; //whether the sum so far is enough, asked as the sum grows (see CheckPartial)
+		SettleCheck m_final; //what the last sum on a frequency was like, for the plan
+		unsigned long m_final_step;
+		unsigned int m_final_pass;
+		unsigned int m_final_signals;
+		double m_centre_freq;
+		double m_freq;
+		unsigned int m_attempts;
+		bool m_retuning;
 		double m_bandwidth0;
-		double m_bandwidth1;
-		double m_bandwidth2;
-		double m_threshold;
-		double m_spread;
 		double m_time;
-		time_t m_start_time;
+		unsigned int m_settle;
+		bool m_use_tags;
+		double m_tuned;
+		bool m_waiting_tag;
+		double m_tag_freq;
+		uint64_t m_tag_offset;
+		unsigned int m_settling;
+		unsigned int m_discarded;
+		uint64_t m_discarded_total;
+		unsigned int m_discarded_max;
+		uint64_t m_hops;
+		double m_started;
+		pmt::pmt_t m_rx_freq;
+		std::vector<gr::tag_t> m_tags; //rx_freq tags in the current call to general_work
+		size_t m_next_tag;
+		pmt::pmt_t m_rx_time;
+		std::vector<gr::tag_t> m_time_tags; //rx_time tags in the current call to general_work
+		size_t m_next_time_tag;
+		bool m_streaming;
+		static volatile sig_atomic_t s_stop;
 };
 
+volatile sig_atomic_t scanner_sink::s_stop = 0;
+
 /* Shared pointer thing gnuradio is fond of */
 typedef boost::shared_ptr<scanner_sink> scanner_sink_sptr;
-scanner_sink_sptr make_scanner_sink(osmosdr::source::sptr source, unsigned int vector_length, double centre_freq_1, double centre_freq_2, double bandwidth0, double bandwidth1, double bandwidth2,
-	double step, unsigned int avg_size, double spread, double threshold, double ptime)
+scanner_sink_sptr make_scanner_sink(tuner_sptr source, detection_worker_sptr worker, sweep_plan_sptr plan, metrics_sptr metrics, control_sptr control,
+	unsigned int device, unsigned int vector_length, unsigned int hop, double bandwidth0, unsigned int avg_size, double ptime, unsigned int settle, bool use_tags,
+	bool adaptive)
 {
-	return boost::shared_ptr<scanner_sink>(new scanner_sink(source, vector_length, centre_freq_1, centre_freq_2, bandwidth0, bandwidth1, bandwidth2, step, avg_size, spread, threshold, ptime));
+	return boost::shared_ptr<scanner_sink>(new scanner_sink(source, worker, plan, metrics, control, device, vector_length, hop, bandwidth0, avg_size, ptime,
+		settle, use_tags, adaptive));
 }
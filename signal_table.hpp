@@ -0,0 +1,177 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef SIGNAL_TABLE_HPP
+#define SIGNAL_TABLE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+/* Everything we know about a signal we've found */
+struct Signal {
+	double mid; //centre frequency when first found (Hz)
+	double min; //lowest edge seen (Hz)
+	double max; //highest edge seen (Hz)
+	float power; //highest peak power seen (dB)
+	double first_seen; //seconds since the epoch
+	double last_seen;
+	unsigned int hits; //number of times it has been detected
+	unsigned int pass; //the last pass of the sweep it was detected in
+};
+
+/*
+ * The signals found so far, ordered by frequency (so finding the neighbours of a new detection
+ * takes O(log n)) and by when they were last seen (so the stalest can be forgotten). The table is
+ * bounded by max_signals and max_age, either of which can be 0 for no limit.
+ */
+class SignalTable
+{
+	public:
+		SignalTable(double spread, size_t max_signals, double max_age) :
+			m_spread(spread), //detections closer than this are the same signal
+			m_max_signals(max_signals), //most signals to remember
+			m_max_age(max_age), //seconds after which a signal we haven't seen again is forgotten
+			m_pass(0) //the pass of the sweep we're on
+		{
+		}
+		
+		/* The signal within m_spread of mid, or 0 if there isn't one */
+		const Signal *Find(double mid)
+		{
+			ByFrequency &signals = m_signals.get<0>();
+			ByFrequency::iterator it = signals.upper_bound(mid - m_spread); //the lowest signal that might be close enough
+			if ((it != signals.end()) && (it->mid - mid < m_spread)){
+				return &*it;
+			}
+			return 0;
+		}
+		
+		/* Records a detection, returning true if it's a signal we didn't already know about */
+		bool Add(double min, double max, float power, double timestamp)
+		{
+			double mid = (min + max)/2.0;
+			Expire(timestamp);
+			
+			const Signal *known = Find(mid);
+			if (known){ //the same signal often appears with a slightly different centre frequency
+				ByFrequency &signals = m_signals.get<0>();
+				signals.modify(signals.iterator_to(*known), SeenAgain(min, max, power, timestamp, m_pass));
+				return false;
+			}
+			
+			if ((m_max_signals > 0) && (m_signals.size() >= m_max_signals)){ //full, so forget the stalest
+				m_signals.get<1>().erase(m_signals.get<1>().begin());
+			}
+			
+			Signal signal = {mid, min, max, power, timestamp, timestamp, 1, m_pass};
+			m_signals.insert(signal);
+			return true;
+		}
+		
+		/* Forgets signals that haven't been seen for m_max_age */
+		void Expire(double now)
+		{
+			if (m_max_age <= 0.0){
+				return;
+			}
+			
+			ByLastSeen &signals = m_signals.get<1>();
+			while (!signals.empty() && (signals.begin()->last_seen < now - m_max_age)){
+				signals.erase(signals.begin());
+			}
+		}
+		
+		/* Moves on to the next pass of the sweep, forgetting (and returning) the signals that weren't seen in the one just finished */
+		void EndPass(std::vector<Signal> &vanished)
+		{
+			ByFrequency &signals = m_signals.get<0>();
+			for (ByFrequency::iterator it = signals.begin(); it != signals.end();){
+				if (it->pass != m_pass){
+					vanished.push_back(*it);
+					it = signals.erase(it);
+				}
+				else {
+					++it;
+				}
+			}
+			m_pass++;
+		}
+		
+		/* Copies out every signal, in order of frequency */
+		void List(std::vector<Signal> &signals)
+		{
+			signals.assign(m_signals.get<0>().begin(), m_signals.get<0>().end());
+		}
+		
+		unsigned int Pass()
+		{
+			return m_pass;
+		}
+		
+		size_t Size()
+		{
+			return m_signals.size();
+		}
+		
+	private:
+		typedef boost::multi_index_container<Signal,
+			boost::multi_index::indexed_by<
+				boost::multi_index::ordered_unique<boost::multi_index::member<Signal, double, &Signal::mid> >,
+				boost::multi_index::ordered_non_unique<boost::multi_index::member<Signal, double, &Signal::last_seen> >
+			>
+		> Table;
+		typedef Table::nth_index<0>::type ByFrequency;
+		typedef Table::nth_index<1>::type ByLastSeen;
+		
+		/* Updates a signal with a new detection of it */
+		struct SeenAgain {
+			SeenAgain(double min, double max, float power, double timestamp, unsigned int pass) :
+				min(min), max(max), power(power), timestamp(timestamp), pass(pass)
+			{
+			}
+			
+			void operator()(Signal &signal)
+			{
+				signal.min = std::min(signal.min, min);
+				signal.max = std::max(signal.max, max);
+				signal.power = std::max(signal.power, power);
+				signal.last_seen = std::max(signal.last_seen, timestamp);
+				signal.hits++;
+				signal.pass = pass;
+			}
+			
+			double min;
+			double max;
+			float power;
+			double timestamp;
+			unsigned int pass;
+		};
+		
+		Table m_signals;
+		double m_spread;
+		size_t m_max_signals;
+		double m_max_age;
+		unsigned int m_pass;
+};
+
+#endif
@@ -0,0 +1,581 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef SPECTRUM_ANALYSER_HPP
+#define SPECTRUM_ANALYSER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+
+#include "arena.hpp"
+#include "control.hpp"
+#include "detector.hpp"
+#include "kernels.hpp"
+#include "signal_table.hpp"
+#include "spectrum_log.hpp"
+#include "spectrum_queue.hpp"
+#include "watchlist.hpp"
+
+/* Seconds since the epoch, to the microsecond */
+static double Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Looks for signals in averaged spectra and reports the ones we haven't seen before */
+class SpectrumAnalyser
+{
+	public:
+		SpectrumAnalyser(unsigned int vector_length, double bandwidth0, double bandwidth1, double bandwidth2, unsigned int avg_size, double spread, double threshold,
+				bool linear, float log_offset, double centre_freq_1, double centre_freq_2, double stitch, size_t max_signals, double max_age,
+				unsigned int passes) :
+			m_signals(spread, max_signals, max_age), //the signals we've found
+			m_scratch(std::max<size_t>(vector_length, (stitch > 0.0) ? SweepBins(vector_length, bandwidth0, centre_freq_1, centre_freq_2) : 0)), //the most bins we work on at once
+			m_arena(4 * Arena::Size<float>(m_scratch) + Arena::Size<double>(m_scratch + 1)), //all the working storage for a spectrum
+			m_vector_length(vector_length), //size of the FFT
+			m_avg_size(avg_size), //the number of FFTs summed in each spectrum
+			m_bandwidth0(bandwidth0), //samples per second
+			m_bandwidth1(bandwidth1), //fine window (band)width
+			m_bandwidth2(bandwidth2), //coarse window (band)width
+			m_threshold(threshold), //threshold in dB for discovery
+			m_spread(spread), //minumum distance between radio signals (overlapping scans might produce slightly different frequencies)
+			m_linear(linear), //whether the input is linear power (so we take the log once we've averaged) rather than dB
+			m_log_offset(log_offset), //the FFT and window normalisation added to the log of the power
+			m_frame_worth(1.0), //independent FFTs each FFT is worth (less than one if they overlap)
+			m_detector(new WindowDetector()), //decides what's a signal (unless SetDetector picks another)
+			m_output(stdout), //where found signals get printed
+			m_start_time(Now()), //the start time of the scan (useful for logging/reporting/monitoring)
+			m_stitch(stitch), //fraction of each spectrum (around the middle) that goes into the sweep's spectrum, or 0 to look at each spectrum on its own
+			m_stitch_start(centre_freq_1 - bandwidth0/2.0), //frequency of the first bin of the sweep's spectrum
+			m_looping(passes != 1) //whether we sweep more than once, and so report how signals change between passes
+		{
+			m_bands0 = m_arena.Take<float>(m_scratch);
+			m_bands1 = m_arena.Take<float>(m_scratch);
+			m_bands2 = m_arena.Take<float>(m_scratch);
+			m_diffs = m_arena.Take<float>(m_scratch);
+			m_prefix = m_arena.Take<double>(m_scratch + 1);
+			
+			size_t bins = SweepBins(vector_length, bandwidth0, centre_freq_1, centre_freq_2);
+			if (m_stitch > 0.0){
+				m_stitch_sum.resize(bins);
+				m_stitch_count.resize(bins);
+			}
+			if (m_looping){
+				m_baseline.resize(bins);
+				m_baseline_count.resize(bins);
+			}
+		}
+		
+		/* One bin for every sample width from the bottom of the first step to the top of the last */
+		static size_t SweepBins(unsigned int vector_length, double bandwidth0, double centre_freq_1, double centre_freq_2)
+		{
+			return (centre_freq_2 - centre_freq_1 + bandwidth0) / (bandwidth0 / vector_length) + 1;
+		}
+		
+		/* Finds and prints the signals in a spectrum of summed FFTs (or just stitches it in, if we're stitching) */
+		void Process(const Spectrum &spectrum)
+		{
+			Rearrange(spectrum.buffer, m_bands0, spectrum.count); //average the buffer, in dB (saves to m_bands0)
+			if (m_log){
+				m_log->Append(spectrum.centre, spectrum.timestamp, m_bandwidth0/m_vector_length, m_bands0, m_vector_length);
+			}
+			Analyse(spectrum.centre, spectrum.timestamp);
+			
+			if (spectrum.discarded > 0){ //so dwell and settle times can be tuned
+				fprintf(stderr, "[*] Dropped %llu samples settling on %f MHz\n", (unsigned long long)spectrum.discarded, spectrum.centre/1000000.0);
+			}
+		}
+		
+		/* Same again for a spectrum that's already averaged and in dB, with 0 Hz in the middle (as read back from a spectrum log) */
+		void ProcessBands(const float *bands, double centre, double timestamp)
+		{
+			std::copy(bands, bands + m_vector_length, m_bands0);
+			Analyse(centre, timestamp);
+		}
+		
+		/* Called at the end of each pass of the sweep: looks for signals in the stitched spectrum, and reports the ones that have gone */
+		void EndSweep(double timestamp)
+		{
+			if (m_stitch > 0.0){
+				FindStitchedSignals(timestamp);
+			}
+			
+			if (m_looping){
+				std::vector<Signal> vanished;
+				m_signals.EndPass(vanished);
+				for (size_t i = 0; i < vanished.size(); i++){
+					Report("[-]", timestamp, "Lost signal: at %f MHz of width %f kHz, peak power %f dB (found %u times)\n",
+						vanished[i].mid / 1000000.0, (vanished[i].max - vanished[i].min)/1000.0, vanished[i].power, vanished[i].hits);
+				}
+				fprintf(stderr, "[*] Finished pass %u\n", m_signals.Pass());
+			}
+		}
+		
+		/*
+		 * Whether count summed FFTs are enough to decide what's in a spectrum: every peak in the difference between the fine and
+		 * coarse windows has to be at least three standard deviations of the averaging noise from the threshold. Also counts the
+		 * signals above the threshold.
+		 */
+		bool Settled(const float *buffer, unsigned int count, unsigned int &signals)
+		{
+			float *bands1 = m_bands1;
+			float *bands2 = m_bands2;
+			float *diffs = m_diffs;
+			Rearrange(buffer, m_bands0, count);
+			GetBands(m_bands0, bands1, bands2, m_vector_length);
+			m_detector->Score(m_bands0, bands1, bands2, m_vector_length, diffs);
+			float margin = Margin(count);
+			
+			bool settled = true;
+			bool sig = false;
+			signals = 0;
+			for (unsigned int i = 1; i + 1 < m_vector_length; i++){
+				float diff = diffs[i];
+				if ((diff >= diffs[i - 1]) && (diff > diffs[i + 1]) && (std::fabs(diff - m_threshold) < margin)){ //a peak we can't be sure about yet
+					settled = false;
+				}
+				if (!sig && (diff >= m_threshold)){
+					signals++;
+				}
+				sig = (diff >= m_threshold);
+			}
+			return settled;
+		}
+		
+		/*
+		 * The fewest summed FFTs Settled could ever say are enough. With fewer, the margin is wider than the threshold, so the peaks
+		 * of the noise floor (which are mostly just above 0 dB) are never clear of it.
+		 */
+		unsigned int SettleCount()
+		{
+			if (m_threshold <= 0.0){
+				return 1;
+			}
+			double count = std::ceil(Margin(1) * Margin(1) / (m_threshold * m_threshold));
+			return (unsigned int)std::min(count, 1e9); //a threshold that low won't settle anyway
+		}
+		
+		/* Which detector decides what's a signal (see MakeDetector) */
+		void SetDetector(const std::string &name)
+		{
+			m_detector = MakeDetector(name, m_scratch, m_bandwidth0/m_vector_length, m_bandwidth1, m_bandwidth2);
+		}
+		
+		/* How many independent FFTs each FFT summed is worth, for overlapping ones (see TopBlock::GetFrameWorth) */
+		void SetFrameWorth(double worth)
+		{
+			m_frame_worth = worth;
+		}
+		
+		/* Where every averaged spectrum gets logged (0 for nowhere) */
+		void SetLog(spectrum_log_writer_sptr log)
+		{
+			m_log = log;
+		}
+		
+		/* What the times printed are counted from (when the analyser was made, unless a log being read back says otherwise) */
+		void SetStartTime(double start_time)
+		{
+			m_start_time = start_time;
+		}
+		
+		/* Where found signals get printed (0 to just remember them) */
+		void SetOutput(FILE *output)
+		{
+			m_output = output;
+		}
+		
+		/* Who else gets told about found signals (0 for nobody) */
+		void SetControl(control_sptr control)
+		{
+			m_control = control;
+		}
+		
+		/* Just measures the channels in watchlist, rather than looking for signals everywhere (0 to look everywhere) */
+		void SetWatchlist(watchlist_sptr watchlist)
+		{
+			m_watchlist = watchlist;
+		}
+		
+		void SetThreshold(double threshold)
+		{
+			m_threshold = threshold;
+		}
+		
+		/*
+		 * Moves the sweep's spectrum to cover centre_freq_1 to centre_freq_2 from the next pass (the stitched spectrum can't grow
+		 * past what we were made for). The usual powers start again, as they were for the old range.
+		 */
+		void SetRange(double centre_freq_1, double centre_freq_2)
+		{
+			size_t bins = SweepBins(m_vector_length, m_bandwidth0, centre_freq_1, centre_freq_2);
+			m_stitch_start = centre_freq_1 - m_bandwidth0/2.0;
+			if (m_stitch > 0.0){
+				m_stitch_sum.assign(std::min(bins, m_scratch), 0.0f);
+				m_stitch_count.assign(std::min(bins, m_scratch), 0);
+			}
+			if (m_looping){
+				m_baseline.assign(bins, 0.0f);
+				m_baseline_count.assign(bins, 0);
+			}
+		}
+		
+		void Signals(std::vector<Signal> &signals)
+		{
+			m_signals.List(signals);
+		}
+		
+		/* The stages of Process are public so they can be benchmarked on their own (bin i of the bands is at start + i sample widths) */
+		void PrintSignals(double start, const float *powers, float *bands1, float *bands2, unsigned int n, double centre, double timestamp)
+		{
+			double samplewidth = m_bandwidth0/(double)m_vector_length;
+			
+			/* Score how far each bin stands out, and look through to find signals */
+			float *diffs = m_diffs;
+			m_detector->Score(powers, bands1, bands2, n, diffs);
+			Detector::Find(diffs, n, m_threshold, m_found);
+			
+			for (size_t i = 0; i < m_found.size(); i++){
+				unsigned int peak = m_found[i].peak;
+				double low = start + m_found[i].min * samplewidth;
+				double high = start + m_found[i].max * samplewidth;
+				double top = start + peak * samplewidth;
+				
+				/* when looping, a signal from an earlier pass is worth reporting again the first time we see it on this one if it's changed */
+				const Signal *known = m_looping ? m_signals.Find((high + low) / 2.0) : 0;
+				bool again = known && (known->pass != m_signals.Pass());
+				
+				/* Print the signal if it's a genuine hit */
+				if (TrySignal(low, high, centre, bands1[peak], timestamp) && m_output){ //no output when we're just collecting candidates
+					Report("[+]", timestamp, "Found signal: at %f MHz of width %f kHz, peak power %f dB (difference %f dB)\n",
+						(high + low) / 2000000.0, (high - low)/1000.0, bands1[peak], diffs[peak]);
+				}
+				else if (again && (std::fabs(bands1[peak] - Baseline(top)) >= m_threshold)){ //false if there's no baseline yet (NaN)
+					Report("[~]", timestamp, "Changed signal: at %f MHz of width %f kHz, peak power %f dB (usually %f dB)\n",
+						(high + low) / 2000000.0, (high - low)/1000.0, bands1[peak], Baseline(top));
+				}
+			}
+		}
+		
+		bool TrySignal(double min, double max, double centre, float power, double timestamp)
+		{
+			double mid = (min + max)/2.0; //calculate the midpoint of the signal
+			
+			/* check to see if the signal is too close to the centre frequency (a signal often erroniously appears there) - never true if centre is NaN */
+			if ((mid - centre < m_spread) && (centre - mid < m_spread)){
+				return false; //if so, this is not a genuine hit
+			}
+			
+			/* check to see if the signal is close to any other (the table just updates the one it's close to) */
+			return m_signals.Add(min, max, power, timestamp); //genuine hit if it's new!:D
+		}
+		
+		void Rearrange(const float *buffer, float *bands, unsigned int count)
+		{
+			Kernels::Scale(bands, buffer, 1.0f/(float)count, m_vector_length); //the sink already put 0 Hz in the middle
+			
+			if (m_linear){ //we averaged power, so convert to dB just the once
+				for (unsigned int i = 0; i < m_vector_length; i++){
+					bands[i] = 10.0 * std::log10(std::max(bands[i], 1e-18f)) + m_log_offset; //floored like nlog10_ff, as -inf from an empty bin would spread through the running sums
+				}
+			}
+		}
+		
+		void GetBands(float *powers, float *bands1, float *bands2, unsigned int n)
+		{
+			/* Both windows are box filters over the same powers, so one running sum serves the fine and the coarse pass */
+			m_prefix[0] = 0.0;
+			for (unsigned int i = 0; i < n; i++){
+				m_prefix[i + 1] = m_prefix[i] + powers[i];
+			}
+			
+			BoxFilter(bands1, m_bandwidth1, n); //apply the fine window
+			BoxFilter(bands2, m_bandwidth2, n); //apply the coarse window
+		}
+		
+		void BoxFilter(float *bands, unsigned int bandwidth, long n)
+		{
+			double samplewidth = m_bandwidth0/(double)m_vector_length; //the width in Hz of each sample
+			long w = (unsigned int)(bandwidth/samplewidth); //the number of samples in our window
+			if (w == 0){ //window narrower than a sample, so nothing gets averaged
+				std::fill(bands, bands + n, 0.0f);
+				return;
+			}
+			
+			/* Only samples whose entire window fits in the buffer contribute (so bands at the edges are partial sums) */
+			long lo = w/2;
+			long hi = n + w/2 - w;
+			
+			/* bands[k] averages the contributing samples in [k + w/2 - w + 1, k + w/2], clipped to [lo, hi) */
+			long start = std::min(n, std::max(0L, w - 1)); //below this the window is clipped by lo
+			long end = std::max(start, n - w); //from here on the window is clipped by hi
+			for (long k = 0; k < start; k++){
+				bands[k] = BoxSum(std::max(lo, k + w/2 - w + 1), std::min(hi, k + w/2 + 1), w);
+			}
+			
+			/* No clipping in the middle, so this loop is branch free and vectorises */
+			long first = w/2 - w + 1;
+			long last = w/2 + 1;
+			for (long k = start; k < end; k++){
+				bands[k] = (m_prefix[k + last] - m_prefix[k + first]) / (double)w;
+			}
+			
+			for (long k = end; k < n; k++){
+				bands[k] = BoxSum(std::max(lo, k + w/2 - w + 1), std::min(hi, k + w/2 + 1), w);
+			}
+		}
+		
+		float BoxSum(long a, long b, long w)
+		{
+			if (b <= a){ //no sample contributes here
+				return 0.0;
+			}
+			return (m_prefix[b] - m_prefix[a]) / (double)w;
+		}
+		
+	private:
+		/*
+		 * How far from the threshold a peak in a sum of count FFTs has to be for Settled to be sure of it: three standard deviations.
+		 * A bin averaged over count FFTs has a standard deviation of about 4.34/sqrt(count) dB if we averaged power, or 5.57/sqrt(count) dB
+		 * if we averaged dB (with count scaled down to the independent FFTs they're worth if they overlap), and the fine window averages that
+		 * over its bins (about half of which are independent, given the window function).
+		 */
+		double Margin(unsigned int count)
+		{
+			double bins = std::max(m_bandwidth1 / (m_bandwidth0/(double)m_vector_length) / 2.0, 1.0);
+			return 3.0 * (m_linear ? 4.34 : 5.57) / std::sqrt(count * m_frame_worth * bins);
+		}
+		
+		/* Everything Process does once the spectrum is in m_bands0 */
+		void Analyse(double centre, double timestamp)
+		{
+			double start = centre - m_bandwidth0/2.0; //frequency of the first bin
+			
+			//Print that we finished scanning something
+			PrintTime(stderr, timestamp);
+			fprintf(stderr, "Finished scanning %f MHz - %f MHz\n", (centre - m_bandwidth0/2.0)/1000000.0, (centre + m_bandwidth0/2.0)/1000000.0);
+			
+			if (m_watchlist){
+				Watch(centre, timestamp);
+			}
+			else if (m_stitch > 0.0){
+				Stitch(m_bands0, centre);
+			}
+			else {
+				GetBands(m_bands0, m_bands1, m_bands2, m_vector_length); //apply the fine and coarse windows (saves to m_bands1 and m_bands2)
+				PrintSignals(start, m_bands0, m_bands1, m_bands2, m_vector_length, centre, timestamp);
+				if (m_looping){
+					UpdateBaseline(start, m_bands1, m_vector_length, centre);
+				}
+			}
+		}
+		
+		/*
+		 * Reports the power in each watched channel of the window tuned to centre, and how far it's above the reference bands either
+		 * side, and finds it as a signal (if it's new) when that's at least the threshold
+		 */
+		void Watch(double centre, double timestamp)
+		{
+			int index = m_watchlist->Find(centre);
+			if (index < 0){
+				return;
+			}
+			
+			double samplewidth = m_bandwidth0/(double)m_vector_length;
+			const std::vector<Channel> &channels = m_watchlist->Windows()[index].channels;
+			for (size_t i = 0; i < channels.size(); i++){
+				double low = channels[i].freq - channels[i].width/2.0;
+				double high = channels[i].freq + channels[i].width/2.0;
+				unsigned int lowest, first, last, end;
+				Watchlist::Bins(channels[i], centre, samplewidth, m_vector_length, lowest, first, last, end);
+				float power = BandPower(first, last, last, last);
+				float reference = BandPower(lowest, first, last, end);
+				float diff = power - reference;
+				bool occupied = (diff >= m_threshold);
+				
+				Report("[=]", timestamp, "Channel at %f MHz of width %f kHz: power %f dB, %f dB above its surroundings (%s)\n",
+					channels[i].freq / 1000000.0, channels[i].width / 1000.0, power, diff, occupied ? "occupied" : "clear");
+				if (occupied && TrySignal(low, high, centre, power, timestamp) && m_output){
+					Report("[+]", timestamp, "Found signal: at %f MHz of width %f kHz, peak power %f dB (difference %f dB)\n",
+						channels[i].freq / 1000000.0, channels[i].width / 1000.0, power, diff);
+				}
+			}
+		}
+		
+		/* The average power, in dB, of the bins of m_bands0 from a to b and from c to d (each one past the end, and either can be empty) */
+		float BandPower(unsigned int a, unsigned int b, unsigned int c, unsigned int d)
+		{
+			double total = 0.0;
+			for (unsigned int i = a; i < b; i++){
+				total += std::pow(10.0, m_bands0[i] / 10.0);
+			}
+			for (unsigned int i = c; i < d; i++){
+				total += std::pow(10.0, m_bands0[i] / 10.0);
+			}
+			return 10.0 * std::log10(total / std::max((b - a) + (d - c), 1u));
+		}
+		
+		/* Looks for signals in the spectrum stitched together over the pass, then clears it for the next one */
+		void FindStitchedSignals(double timestamp)
+		{
+			size_t n = m_stitch_sum.size();
+			double samplewidth = m_bandwidth0/(double)m_vector_length;
+			float *bands0 = m_bands0;
+			
+			/* average where steps overlapped, and fill in anything no step covered from its neighbours so it can't look like a signal */
+			float last = NAN;
+			for (size_t i = 0; i < n; i++){
+				if (m_stitch_count[i] > 0){
+					last = m_stitch_sum[i] / m_stitch_count[i];
+				}
+				bands0[i] = last;
+			}
+			for (size_t i = n; i > 0; i--){
+				if (bands0[i - 1] != bands0[i - 1]){ //NaN before the first covered bin
+					bands0[i - 1] = (i < n) ? bands0[i] : 0.0;
+				}
+			}
+			
+			fprintf(stderr, "[*] Looking for signals in the stitched spectrum %f MHz - %f MHz\n", m_stitch_start/1000000.0, (m_stitch_start + (n - 1) * samplewidth)/1000000.0);
+			GetBands(bands0, m_bands1, m_bands2, n);
+			PrintSignals(m_stitch_start, bands0, m_bands1, m_bands2, n, NAN, timestamp); //the steps' centres were never stitched in, so there's no centre to avoid
+			if (m_looping){
+				UpdateBaseline(m_stitch_start, m_bands1, n, NAN);
+			}
+			
+			std::fill(m_stitch_sum.begin(), m_stitch_sum.end(), 0.0f);
+			std::fill(m_stitch_count.begin(), m_stitch_count.end(), 0);
+		}
+		
+		/* Adds the usable part of a rearranged spectrum to the sweep's spectrum: the middle m_stitch of it, less m_spread either side of the centre */
+		void Stitch(const float *bands, double centre)
+		{
+			double samplewidth = m_bandwidth0/(double)m_vector_length;
+			long first = (centre - m_bandwidth0/2.0 - m_stitch_start) / samplewidth + 0.5; //where bands[0] goes
+			for (long i = 0; i < (long)m_vector_length; i++){
+				double offset = (i - (long)m_vector_length/2) * samplewidth; //from the centre
+				if ((std::fabs(offset) > m_stitch * m_bandwidth0/2.0) || (std::fabs(offset) < m_spread)){ //filter roll-off or DC spike
+					continue;
+				}
+				if ((first + i < 0) || (first + i >= (long)m_stitch_sum.size())){ //outside the sweep
+					continue;
+				}
+				m_stitch_sum[first + i] += bands[i];
+				m_stitch_count[first + i]++;
+			}
+		}
+		
+		/* Folds the fine window powers of a spectrum into the per-bin average over passes (only the middle of each step, where the filter's flat, unless it's stitched) */
+		void UpdateBaseline(double start, const float *bands, size_t n, double centre)
+		{
+			double samplewidth = m_bandwidth0/(double)m_vector_length;
+			for (size_t i = 0; i < n; i++){
+				double freq = start + i * samplewidth;
+				if ((centre == centre) && ((std::fabs(freq - centre) > m_bandwidth0/4.0) || (std::fabs(freq - centre) < m_spread))){
+					continue;
+				}
+				long bin = (freq - m_stitch_start) / samplewidth + 0.5;
+				if ((bin < 0) || (bin >= (long)m_baseline.size())){ //outside the sweep
+					continue;
+				}
+				if (m_baseline_count[bin] < 16){ //a plain average to begin with, then exponential so the baseline can follow slow changes
+					m_baseline_count[bin]++;
+				}
+				m_baseline[bin] += (bands[i] - m_baseline[bin]) / m_baseline_count[bin];
+			}
+		}
+		
+		/* The usual fine window power at freq, or NaN if we haven't got one yet */
+		float Baseline(double freq)
+		{
+			long bin = (freq - m_stitch_start) / (m_bandwidth0/(double)m_vector_length) + 0.5;
+			if ((bin < 0) || (bin >= (long)m_baseline.size()) || (m_baseline_count[bin] == 0)){
+				return NAN;
+			}
+			return m_baseline[bin];
+		}
+		
+		/* Prints a line about a signal after mark and the time, and sends it to whoever's subscribed */
+		void Report(const char *mark, double timestamp, const char *format, ...)
+		{
+			char line[512];
+			unsigned int t = timestamp - m_start_time;
+			int n = snprintf(line, sizeof(line), "%s %02u:%02u:%02u: ", mark, t / 3600, (t % 3600) / 60, t % 60);
+			va_list args;
+			va_start(args, format);
+			vsnprintf(line + n, sizeof(line) - n, format, args);
+			va_end(args);
+			
+			if (m_output){
+				fputs(line, m_output);
+			}
+			if (m_control){
+				m_control->Publish(line);
+			}
+		}
+		
+		void PrintTime(FILE *output, double timestamp)
+		{
+			/* Calculate the time after start that the spectrum was taken */
+			unsigned int t = timestamp - m_start_time;
+			fprintf(output, "%02u:%02u:%02u: ", t / 3600, (t % 3600) / 60, t % 60);
+		}
+		
+		SignalTable m_signals;
+		size_t m_scratch;
+		Arena m_arena;
+		float *m_bands0; //bands in order of frequency
+		float *m_bands1; //fine window bands
+		float *m_bands2; //coarse window bands
+		float *m_diffs; //how far each bin stands out, as the detector scored it
+		double *m_prefix; //running sum of the powers for the band windows
+		unsigned int m_vector_length;
+		unsigned int m_avg_size;
+		double m_bandwidth0;
+		double m_bandwidth1;
+		double m_bandwidth2;
+		double m_threshold;
+		double m_spread;
+		bool m_linear;
+		float m_log_offset;
+		double m_frame_worth;
+		detector_sptr m_detector;
+		std::vector<Detection> m_found; //the detector's runs of bins in the spectrum being looked at
+		FILE *m_output;
+		control_sptr m_control;
+		watchlist_sptr m_watchlist;
+		spectrum_log_writer_sptr m_log;
+		double m_start_time;
+		double m_stitch;
+		double m_stitch_start;
+		std::vector<float> m_stitch_sum; //total of the dB values stitched into each bin of the sweep
+		std::vector<unsigned short> m_stitch_count; //number of steps that covered each bin
+		bool m_looping;
+		std::vector<float> m_baseline; //fine window power in each bin of the sweep, averaged over passes
+		std::vector<unsigned char> m_baseline_count; //number of times each bin has been averaged in (up to 16)
+};
+
+#endif
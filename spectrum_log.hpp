@@ -0,0 +1,482 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef SPECTRUM_LOG_HPP
+#define SPECTRUM_LOG_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/*
+ * A log of every averaged spectrum, in dB with 0 Hz in the middle, as detection saw it. The log file is
+ *
+ *	"GRSCANSL" <uint32 version> <uint32 record header size>
+ *	then for every spectrum: "SPEC" <uint32 bins> <double centre Hz> <double timestamp> <double bin width Hz> <int16 bins...>
+ *
+ * with each bin in hundredths of a dB (so -327.67 to 327.67 dB, and -32768 for no value), all in the host's
+ * byte order. Next to it, FILE.idx holds "GRSCANSI" then <uint64 offset> <double centre> <double timestamp>
+ * for every record, so a reader can find spectra without going through the whole log (if the index is
+ * missing or short, as after a crash, the reader finds the rest itself). Logging to an existing log adds to it.
+ */
+namespace SpectrumLog
+{
+	struct FileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t record_header_size;
+	};
+	
+	struct RecordHeader {
+		char magic[4];
+		uint32_t bins;
+		double centre;
+		double timestamp;
+		double bin_width;
+	};
+	
+	struct IndexEntry {
+		uint64_t offset;
+		double centre;
+		double timestamp;
+	};
+	
+	static const char s_file_magic[8] = {'G', 'R', 'S', 'C', 'A', 'N', 'S', 'L'};
+	static const char s_index_magic[8] = {'G', 'R', 'S', 'C', 'A', 'N', 'S', 'I'};
+	static const char s_record_magic[4] = {'S', 'P', 'E', 'C'};
+	static const int16_t s_none = -32768;
+	
+	inline int16_t Quantise(float db)
+	{
+		if (db != db){ //NaN
+			return s_none;
+		}
+		float centi = std::floor(db * 100.0f + 0.5f);
+		return (int16_t)std::max(std::min(centi, 32767.0f), -32767.0f);
+	}
+	
+	inline float Dequantise(int16_t value)
+	{
+		return (value == s_none) ? NAN : value / 100.0f;
+	}
+}
+
+/*
+ * Appends spectra to a log. Append just quantises the spectrum into a batch in memory; a thread of the
+ * writer's own writes the batches out, so a slow disk never holds up detection.
+ */
+class SpectrumLogWriter
+{
+	public:
+		SpectrumLogWriter(const std::string &path) :
+			m_stop(false)
+		{
+			m_log = Open(path, SpectrumLog::s_file_magic, true);
+			m_index = Open(path + ".idx", SpectrumLog::s_index_magic, false);
+			Recover(path);
+			fseeko(m_log, 0, SEEK_END);
+			m_offset = ftello(m_log); //where the next record goes
+			m_thread = boost::thread(&SpectrumLogWriter::Run, this);
+		}
+		
+		~SpectrumLogWriter()
+		{
+			Close();
+		}
+		
+		/* Writes out what's left and closes the files (anything appended after this is dropped) */
+		void Close()
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				if (m_stop){
+					return;
+				}
+				m_stop = true;
+			}
+			m_wake.notify_one();
+			m_thread.join();
+			fclose(m_log);
+			fclose(m_index);
+		}
+		
+		/* Adds a spectrum of bins dB values, the first of them centred bin_width/2 above centre - bins*bin_width/2 */
+		void Append(double centre, double timestamp, double bin_width, const float *bands, unsigned int bins)
+		{
+			SpectrumLog::RecordHeader header;
+			memcpy(header.magic, SpectrumLog::s_record_magic, sizeof(header.magic));
+			header.bins = bins;
+			header.centre = centre;
+			header.timestamp = timestamp;
+			header.bin_width = bin_width;
+			
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (m_stop){
+				return;
+			}
+			SpectrumLog::IndexEntry entry = {m_offset, centre, timestamp};
+			size_t at = m_pending.size();
+			m_pending.resize(at + sizeof(header) + bins * sizeof(int16_t));
+			memcpy(&m_pending[at], &header, sizeof(header));
+			int16_t *values = (int16_t *)&m_pending[at + sizeof(header)];
+			for (unsigned int i = 0; i < bins; i++){
+				values[i] = SpectrumLog::Quantise(bands[i]);
+			}
+			m_pending_index.push_back(entry);
+			m_offset += sizeof(header) + bins * sizeof(int16_t);
+			
+			if (m_pending.size() >= s_batch){
+				m_wake.notify_one();
+			}
+		}
+		
+	private:
+		/* Opens a log or index to add to, writing its header if it's new and checking it if it isn't */
+		static FILE *Open(const std::string &path, const char *magic, bool log)
+		{
+			FILE *file = fopen(path.c_str(), "a+b");
+			if (!file){
+				throw std::runtime_error("spectrum log: can't open " + path);
+			}
+			
+			fseeko(file, 0, SEEK_END);
+			if (ftello(file) == 0){
+				SpectrumLog::FileHeader header;
+				memcpy(header.magic, magic, sizeof(header.magic));
+				header.version = 1;
+				header.record_header_size = log ? sizeof(SpectrumLog::RecordHeader) : sizeof(SpectrumLog::IndexEntry);
+				fwrite(log ? (const void *)&header : (const void *)magic, log ? sizeof(header) : sizeof(header.magic), 1, file);
+				fflush(file);
+				return file;
+			}
+			
+			char found[8];
+			fseeko(file, 0, SEEK_SET);
+			if ((fread(found, sizeof(found), 1, file) != 1) || (memcmp(found, magic, sizeof(found)) != 0)){
+				fclose(file);
+				throw std::runtime_error("spectrum log: " + path + " isn't one of ours");
+			}
+			return file;
+		}
+		
+		/*
+		 * Cuts off anything after the last whole record, and any index entries for what's gone, as a run that didn't finish
+		 * can leave behind. Otherwise a reader would stop at the part written record, and never see what we add after it.
+		 */
+		void Recover(const std::string &path)
+		{
+			fseeko(m_log, 0, SEEK_END);
+			uint64_t bytes = ftello(m_log);
+			fseeko(m_index, 0, SEEK_END);
+			uint64_t entries = (ftello(m_index) - sizeof(SpectrumLog::s_index_magic)) / sizeof(SpectrumLog::IndexEntry);
+			
+			/* start from the last record the index lists that's really there, rather than going through the whole log */
+			uint64_t end = sizeof(SpectrumLog::FileHeader);
+			for (uint64_t i = entries; i > 0; i--){
+				SpectrumLog::IndexEntry entry;
+				fseeko(m_index, sizeof(SpectrumLog::s_index_magic) + (i - 1) * sizeof(entry), SEEK_SET);
+				if ((fread(&entry, sizeof(entry), 1, m_index) == 1) && (entry.offset >= end) && Whole(entry.offset, bytes)){
+					end = entry.offset;
+					break;
+				}
+			}
+			uint64_t next;
+			while ((next = Whole(end, bytes))){
+				end = next;
+			}
+			
+			if (end < bytes){
+				fprintf(stderr, "[*] Cutting %llu bytes of a part written record off the end of %s\n", (unsigned long long)(bytes - end), path.c_str());
+				Truncate(m_log, end, path);
+			}
+			for (; entries > 0; entries--){ //entries for records that have gone (there's at most a batch of them)
+				SpectrumLog::IndexEntry entry;
+				fseeko(m_index, sizeof(SpectrumLog::s_index_magic) + (entries - 1) * sizeof(entry), SEEK_SET);
+				if ((fread(&entry, sizeof(entry), 1, m_index) == 1) && (entry.offset < end)){
+					break;
+				}
+			}
+			fseeko(m_index, 0, SEEK_END);
+			if (sizeof(SpectrumLog::s_index_magic) + entries * sizeof(SpectrumLog::IndexEntry) < (uint64_t)ftello(m_index)){ //also drops a part written entry
+				Truncate(m_index, sizeof(SpectrumLog::s_index_magic) + entries * sizeof(SpectrumLog::IndexEntry), path + ".idx");
+			}
+		}
+		
+		/* Where the record at offset ends, or 0 if there isn't a whole one there in a log of bytes */
+		uint64_t Whole(uint64_t offset, uint64_t bytes)
+		{
+			SpectrumLog::RecordHeader header;
+			fseeko(m_log, offset, SEEK_SET);
+			if ((offset + sizeof(header) > bytes) || (fread(&header, sizeof(header), 1, m_log) != 1) ||
+					(memcmp(header.magic, SpectrumLog::s_record_magic, sizeof(header.magic)) != 0)){
+				return 0;
+			}
+			uint64_t end = offset + sizeof(header) + (uint64_t)header.bins * sizeof(int16_t);
+			return (end <= bytes) ? end : 0;
+		}
+		
+		static void Truncate(FILE *file, uint64_t bytes, const std::string &path)
+		{
+			fflush(file);
+			if (ftruncate(fileno(file), bytes) < 0){
+				throw std::runtime_error("spectrum log: can't cut the end off " + path);
+			}
+		}
+		
+		/* Writes out a batch whenever one fills up, or every second anyway */
+		void Run()
+		{
+			std::vector<char> data;
+			std::vector<SpectrumLog::IndexEntry> index;
+			while (true){
+				bool stopping;
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+					if (!m_stop && (m_pending.size() < s_batch)){
+						m_wake.timed_wait(lock, boost::posix_time::seconds(1));
+					}
+					stopping = m_stop;
+					data.swap(m_pending);
+					index.swap(m_pending_index);
+				}
+				
+				if (!data.empty()){ //the records first, so the index never points past the end of the log
+					fwrite(&data[0], 1, data.size(), m_log);
+					fflush(m_log);
+					fwrite(&index[0], sizeof(SpectrumLog::IndexEntry), index.size(), m_index);
+					fflush(m_index);
+					data.clear();
+					index.clear();
+				}
+				if (stopping){
+					return;
+				}
+			}
+		}
+		
+		static const size_t s_batch = 1 << 20; //bytes of records to gather before writing them
+		
+		FILE *m_log;
+		FILE *m_index;
+		uint64_t m_offset;
+		boost::mutex m_mutex;
+		boost::condition_variable m_wake;
+		std::vector<char> m_pending; //records waiting to be written
+		std::vector<SpectrumLog::IndexEntry> m_pending_index;
+		bool m_stop;
+		boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<SpectrumLogWriter> spectrum_log_writer_sptr;
+
+/*
+ * Reads a log back. The log is mapped, and the records the index lists are only looked at when they're first asked
+ * for, so opening a long log doesn't go through all of it.
+ */
+class SpectrumLogReader
+{
+	public:
+		struct Record {
+			double centre; //Hz
+			double timestamp; //seconds since the epoch
+			double bin_width; //Hz
+			unsigned int bins;
+			const int16_t *values; //hundredths of a dB
+		};
+		
+		SpectrumLogReader(const std::string &path) :
+			m_map(0),
+			m_bytes(0)
+		{
+			m_map = Map(path, m_bytes);
+			const SpectrumLog::FileHeader *header = (const SpectrumLog::FileHeader *)m_map;
+			if ((m_bytes < sizeof(*header)) || (memcmp(header->magic, SpectrumLog::s_file_magic, sizeof(header->magic)) != 0) ||
+					(header->record_header_size != sizeof(SpectrumLog::RecordHeader))){
+				Unmap();
+				throw std::runtime_error("spectrum log: " + path + " isn't one of ours");
+			}
+			
+			uint64_t offset = sizeof(*header);
+			ReadIndex(path + ".idx", offset);
+			Scan(offset);
+		}
+		
+		~SpectrumLogReader()
+		{
+			Unmap();
+		}
+		
+		size_t Size()
+		{
+			return m_records.size();
+		}
+		
+		const Record &Get(size_t i)
+		{
+			if (!m_records[i].values && !Load(i)){
+				throw std::runtime_error("spectrum log: the index lists a record that isn't in the log");
+			}
+			return m_records[i];
+		}
+		
+		/* The i'th spectrum in dB (NaN where there was no value) */
+		void Read(size_t i, float *bands)
+		{
+			const Record &record = Get(i);
+			for (unsigned int j = 0; j < record.bins; j++){
+				bands[j] = SpectrumLog::Dequantise(record.values[j]);
+			}
+		}
+		
+	private:
+		static char *Map(const std::string &path, size_t &bytes)
+		{
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0){
+				throw std::runtime_error("spectrum log: can't open " + path);
+			}
+			struct stat st;
+			if ((fstat(fd, &st) < 0) || (st.st_size == 0)){
+				close(fd);
+				throw std::runtime_error("spectrum log: empty log " + path);
+			}
+			bytes = st.st_size;
+			void *map = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (map == MAP_FAILED){
+				throw std::runtime_error("spectrum log: can't map " + path);
+			}
+			return (char *)map;
+		}
+		
+		void Unmap()
+		{
+			if (m_map){
+				munmap(m_map, m_bytes);
+				m_map = 0;
+			}
+		}
+		
+		/* Takes the records the index lists (checking only that the last is there), leaving offset just past the last of them */
+		void ReadIndex(const std::string &path, uint64_t &offset)
+		{
+			size_t bytes;
+			char *index;
+			try {
+				index = Map(path, bytes);
+			}
+			catch (std::runtime_error &){
+				return; //we'll find them all ourselves
+			}
+			
+			if ((bytes >= 8) && (memcmp(index, SpectrumLog::s_index_magic, 8) == 0)){
+				const SpectrumLog::IndexEntry *entries = (const SpectrumLog::IndexEntry *)(index + 8);
+				size_t count = (bytes - 8) / sizeof(SpectrumLog::IndexEntry);
+				uint64_t last = offset;
+				for (size_t i = 0; i < count; i++){
+					SpectrumLog::IndexEntry entry;
+					memcpy(&entry, &entries[i], sizeof(entry));
+					if ((entry.offset >= m_bytes) || ((i == 0) ? (entry.offset != offset) : (entry.offset <= last))){
+						break;
+					}
+					Record record = {entry.centre, entry.timestamp, 0.0, 0, 0};
+					m_records.push_back(record);
+					m_offsets.push_back(entry.offset);
+					last = entry.offset;
+				}
+				while (!m_records.empty() && !Load(m_records.size() - 1)){ //the index can't be ahead of the log, but just in case
+					m_records.pop_back();
+					m_offsets.pop_back();
+				}
+				if (!m_records.empty()){
+					const Record &record = m_records.back();
+					offset = m_offsets.back() + sizeof(SpectrumLog::RecordHeader) + (uint64_t)record.bins * sizeof(int16_t);
+				}
+			}
+			munmap(index, bytes);
+		}
+		
+		/* Fills in the rest of the i'th record from its header, or returns false if there isn't a whole one there */
+		bool Load(size_t i)
+		{
+			SpectrumLog::RecordHeader header;
+			if (!Header(m_offsets[i], header)){
+				return false;
+			}
+			Record &record = m_records[i];
+			record.bin_width = header.bin_width;
+			record.bins = header.bins;
+			record.values = (const int16_t *)(m_map + m_offsets[i] + sizeof(header));
+			return true;
+		}
+		
+		/* Takes the records from offset on */
+		void Scan(uint64_t offset)
+		{
+			while (Take(offset)){
+			}
+		}
+		
+		/* Takes the record at offset (moving it on to the next), or returns false if there isn't a whole one there */
+		bool Take(uint64_t &offset)
+		{
+			SpectrumLog::RecordHeader header;
+			if (!Header(offset, header)){
+				return false;
+			}
+			
+			Record record = {header.centre, header.timestamp, header.bin_width, header.bins, (const int16_t *)(m_map + offset + sizeof(header))};
+			m_records.push_back(record);
+			m_offsets.push_back(offset);
+			offset += sizeof(header) + (uint64_t)header.bins * sizeof(int16_t);
+			return true;
+		}
+		
+		/* Copies out the header of the record at offset, or returns false if there isn't a whole record there */
+		bool Header(uint64_t offset, SpectrumLog::RecordHeader &header)
+		{
+			if (offset + sizeof(header) > m_bytes){
+				return false;
+			}
+			memcpy(&header, m_map + offset, sizeof(header)); //records are only 2 byte aligned, which isn't enough for the doubles everywhere
+			uint64_t end = offset + sizeof(header) + (uint64_t)header.bins * sizeof(int16_t);
+			return (memcmp(header.magic, SpectrumLog::s_record_magic, sizeof(header.magic)) == 0) && (end <= m_bytes);
+		}
+		
+		char *m_map;
+		size_t m_bytes;
+		std::vector<Record> m_records; //values is 0 until a record the index listed is first asked for
+		std::vector<uint64_t> m_offsets; //where each record starts in the log
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef SPECTRUM_QUEUE_HPP
+#define SPECTRUM_QUEUE_HPP
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+
+#include "arena.hpp"
+
+/* A sink's question to detection of whether a sum of FFTs is enough to decide what's in it, and the answer (see DetectionWorker::Check) */
+struct SettleCheck {
+	enum {IDLE, ASKED, ANSWERED};
+	boost::atomic<int> state; //only detection moves it to ANSWERED, and only the sink back to IDLE
+	unsigned int sum; //which of the sink's sums it's about
+	bool settled; //the answer
+	unsigned int signals; //above the threshold in the sum
+};
+
+/* An averaged spectrum on its way from the sink to detection */
+struct Spectrum {
+	float *buffer; //sum of the FFTs, with 0 Hz in the middle
+	unsigned int count; //number of FFTs summed
+	double centre; //frequency we were tuned to
+	double timestamp; //seconds since the epoch when the last FFT was added
+	uint64_t discarded; //samples dropped while the source settled after the retune (0 after the first spectrum of a hop)
+	SettleCheck *check; //where to say whether the sum's settled (0 not to bother)
+	bool partial; //just a sum still being averaged, to check, rather than a spectrum to look for signals in
+	bool end_of_sweep; //no spectrum, just marks the end of a pass over the frequency range
+	double next_start; //with end_of_sweep, the first and last steps of the next pass if the range has been changed (NaN if it hasn't)
+	double next_end;
+	std::vector<size_t> pushed; //with end_of_sweep, how many spectra each device's queue had been given when the pass ended
+};
+
+/*
+ * Fixed size ring of spectra for exactly one producer (a device's sink) and one consumer (the detection
+ * worker). Neither side ever takes a lock: the producer fills the slot from Back() and publishes it
+ * with Push(), the consumer reads Front() and hands the slot back with Pop().
+ */
+class SpectrumQueue
+{
+	public:
+		SpectrumQueue(unsigned int vector_length, size_t size) :
+			m_storage(size * Arena::Size<float>(vector_length)), //each slot's buffer on cache lines of its own
+			m_slots(size),
+			m_head(0), //next slot the producer fills
+			m_tail(0) //next slot the consumer reads
+		{
+			for (size_t i = 0; i < size; i++){
+				m_slots[i].buffer = m_storage.Take<float>(vector_length);
+			}
+		}
+		
+		/* The slot to fill next, or 0 if the queue is full */
+		Spectrum *Back()
+		{
+			size_t head = m_head.load(boost::memory_order_relaxed);
+			if (head - m_tail.load(boost::memory_order_acquire) == m_slots.size()){
+				return 0;
+			}
+			return &m_slots[head % m_slots.size()];
+		}
+		
+		void Push()
+		{
+			m_head.store(m_head.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+		}
+		
+		/* The oldest spectrum, or 0 if the queue is empty */
+		Spectrum *Front()
+		{
+			size_t tail = m_tail.load(boost::memory_order_relaxed);
+			if (tail == m_head.load(boost::memory_order_acquire)){
+				return 0;
+			}
+			return &m_slots[tail % m_slots.size()];
+		}
+		
+		void Pop()
+		{
+			m_tail.store(m_tail.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+		}
+		
+		/* Spectra pushed so far (from either side) */
+		size_t Pushed()
+		{
+			return m_head.load(boost::memory_order_acquire);
+		}
+		
+		/* Spectra popped so far (from the consumer) */
+		size_t Popped()
+		{
+			return m_tail.load(boost::memory_order_relaxed);
+		}
+		
+		size_t Size()
+		{
+			return m_head.load(boost::memory_order_acquire) - m_tail.load(boost::memory_order_acquire);
+		}
+		
+		size_t Capacity()
+		{
+			return m_slots.size();
+		}
+		
+	private:
+		Arena m_storage;
+		std::vector<Spectrum> m_slots;
+		boost::atomic<size_t> m_head;
+		boost::atomic<size_t> m_tail;
+};
+
+#endif
@@ -0,0 +1,312 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef SWEEP_PLAN_HPP
+#define SWEEP_PLAN_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+/*
+ * Hands out the steps of the sweep to the devices scanning it. Each device starts with its own
+ * contiguous share of the range, and one that runs out steals the top half of what's left of
+ * whichever device has the most still to do, so they all finish a pass at about the same time.
+ * If it's adaptive, the plan also remembers what each step was like when it was last visited, and
+ * uses that to decide how long to listen on it and how often to come back. Passes with every step
+ * resting are skipped, the next one waiting as long as they'd have taken. Steps a device couldn't
+ * tune to are left out of its later passes, so it doesn't try them again every time round.
+ */
+class SweepPlan
+{
+	public:
+		SweepPlan(double centre_freq_1, double centre_freq_2, double step, unsigned int devices, unsigned int passes, bool adaptive) :
+			m_centre_freq_1(centre_freq_1), //frequency of the first step
+			m_step(step), //the amount by which the frequency is incremented
+			m_steps((centre_freq_2 > centre_freq_1) ? std::ceil((centre_freq_2 - centre_freq_1)/step - 1e-6) + 1 : 1), //we stop once we've listened at or above centre_freq_2
+			m_ranges(devices),
+			m_holes(devices), //for each device, the steps it can't tune to (empty until it finds one)
+			m_passes(passes), //number of passes to make, or 0 to go until we're stopped
+			m_pass(0), //passes completed
+			m_range_pass(0), //the first pass over the range as it is now
+			m_idle(0), //devices with nothing left to do this pass
+			m_active(devices), //devices still scanning
+			m_visits(0), //steps handed out this pass
+			m_pass_started(0.0), //when the first of them was
+			m_pass_seconds(0.0), //how long the last pass that visited anything took
+			m_resume(0.0), //when the pass can start, if it's waiting out skipped ones
+			m_finished(false)
+		{
+			Split();
+			if (adaptive){ //keep track of what each step's been like, to decide how long to listen and how often
+				History fresh = {0, 0, 0, 1};
+				m_history.assign(m_steps, fresh);
+			}
+		}
+		
+		/* A plan that visits just the frequencies given */
+		SweepPlan(const std::vector<double> &freqs, unsigned int devices, unsigned int passes, bool adaptive) :
+			m_centre_freq_1(0.0),
+			m_step(0.0),
+			m_steps(freqs.size()),
+			m_freqs(freqs),
+			m_ranges(devices),
+			m_holes(devices),
+			m_passes(passes),
+			m_pass(0),
+			m_range_pass(0),
+			m_idle(0),
+			m_active(devices),
+			m_visits(0),
+			m_pass_started(0.0),
+			m_pass_seconds(0.0),
+			m_resume(0.0),
+			m_finished(false)
+		{
+			Split();
+			if (adaptive){
+				History fresh = {0, 0, 0, 1};
+				m_history.assign(m_steps, fresh);
+			}
+		}
+		
+		/*
+		 * Gets the next frequency for device to listen on (at now, in seconds), the number of spectra to listen for, and the step it
+		 * is (for Record), returning false if there's nothing left for it (or anyone else) this pass
+		 */
+		bool Next(unsigned int device, double now, double &freq, unsigned int &dwell, unsigned long &step)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			Range &range = m_ranges[device];
+			while (true){
+				if ((range.next == range.end) && !Steal(range)){
+					return false;
+				}
+				
+				range.current = range.next++;
+				if (!m_holes[device].empty() && m_holes[device][range.current]){ //we know we can't get there
+					continue;
+				}
+				if (m_history.empty() || (m_history[range.current].next_pass <= m_pass)){ //not a quiet step we're giving a rest this pass
+					break;
+				}
+			}
+			
+			if (m_visits++ == 0){
+				m_pass_started = now;
+			}
+			freq = m_freqs.empty() ? m_centre_freq_1 + range.current * m_step : m_freqs[range.current];
+			dwell = m_history.empty() ? 1 : m_history[range.current].dwell;
+			step = range.current;
+			return true;
+		}
+		
+		/*
+		 * Records what was found on a step visited in pass: the number of signals, and whether the detection margin settled (which
+		 * detection may only have worked out after the device moved on). Steps with signals, a change in them, or an unsettled
+		 * margin get listened to for longer and on every pass; quiet ones get left out of more and more passes (up to three in four).
+		 */
+		void Record(unsigned long step, unsigned int pass, unsigned int signals, bool settled)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if ((step >= m_history.size()) || (pass < m_range_pass)){ //not adapting, or it's from before the range changed
+				return;
+			}
+			
+			History &history = m_history[step];
+			bool busy = (signals > 0) || !settled || (signals != history.signals);
+			history.quiet = busy ? 0 : std::min(history.quiet + 1, 3u);
+			history.next_pass = pass + 1 + history.quiet;
+			history.dwell = busy ? 2 : 1;
+			history.signals = signals;
+		}
+		
+		/* Records that device couldn't tune to the step Next last gave it */
+		void Untunable(unsigned int device)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			std::vector<bool> &holes = m_holes[device];
+			if (holes.empty()){
+				holes.resize(m_steps);
+			}
+			holes[m_ranges[device].current] = true;
+		}
+		
+		/* Sweeps from centre_freq_1 to centre_freq_2 from the next pass on, forgetting what we knew about the old steps (only between passes) */
+		void SetRange(double centre_freq_1, double centre_freq_2, double step)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_centre_freq_1 = centre_freq_1;
+			m_step = step;
+			m_range_pass = m_pass + 1;
+			m_steps = (centre_freq_2 > centre_freq_1) ? std::ceil((centre_freq_2 - centre_freq_1)/step - 1e-6) + 1 : 1;
+			m_freqs.clear();
+			for (size_t i = 0; i < m_holes.size(); i++){
+				m_holes[i].clear();
+			}
+			if (!m_history.empty()){
+				History fresh = {0, 0, 0, 1};
+				m_history.assign(m_steps, fresh);
+			}
+		}
+		
+		/* Called by a device once Next has returned false, returning true for the last one, which should end the pass */
+		bool Idle()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			return ++m_idle == m_active;
+		}
+		
+		/*
+		 * Starts the next pass (at now), or finishes if that was the last. If every step's resting then, it skips to the pass the
+		 * first of them is due on, which waits (see Waiting) for as long as the passes skipped would have taken.
+		 */
+		void EndPass(double now)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (m_visits > 0){
+				m_pass_seconds = now - m_pass_started;
+			}
+			m_pass++;
+			unsigned int due = Due();
+			if (due > m_pass){
+				m_resume = now + (due - m_pass) * m_pass_seconds;
+				m_pass = due;
+			}
+			if ((m_passes != 0) && (m_pass >= m_passes)){
+				m_finished = true;
+				return;
+			}
+			Split();
+			m_idle = 0;
+			m_visits = 0;
+		}
+		
+		/* Whether the pass that's started is still waiting out the ones skipped before it, at now */
+		bool Waiting(double now)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			return now < m_resume;
+		}
+		
+		/* Called by a device once it's stopped scanning, returning true for the last one */
+		bool Leave()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			return --m_active == 0;
+		}
+		
+		unsigned int Pass()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			return m_pass;
+		}
+		
+		bool Finished()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			return m_finished;
+		}
+		
+	private:
+		struct Range {
+			unsigned long next; //index of the next step to listen on
+			unsigned long end; //one past the last step
+			unsigned long current; //the step being listened on
+		};
+		
+		struct History {
+			unsigned int signals; //signals found on the last visit
+			unsigned int quiet; //visits in a row with nothing going on
+			unsigned int next_pass; //the pass the step is next due on
+			unsigned int dwell; //spectra to listen for on the next visit
+		};
+		
+		/* Takes the top half of what's left of whichever device has the most still to do, returning false if there's nothing left anywhere */
+		bool Steal(Range &range)
+		{
+			Range *victim = &range;
+			for (size_t i = 0; i < m_ranges.size(); i++){
+				if (m_ranges[i].end - m_ranges[i].next > victim->end - victim->next){
+					victim = &m_ranges[i];
+				}
+			}
+			if (victim == &range){
+				return false;
+			}
+			
+			unsigned long mid = victim->next + (victim->end - victim->next)/2;
+			range.next = mid;
+			range.end = victim->end;
+			victim->end = mid;
+			return true;
+		}
+		
+		/* The first pass any step we can tune to is due on (just the current pass if we aren't adapting, or can't tune to anything) */
+		unsigned int Due()
+		{
+			bool any = false;
+			unsigned int due = m_pass;
+			for (size_t step = 0; (step < m_history.size()) && !(any && (due <= m_pass)); step++){
+				bool reachable = false;
+				for (size_t i = 0; (i < m_holes.size()) && !reachable; i++){
+					reachable = m_holes[i].empty() || !m_holes[i][step];
+				}
+				if (reachable && (!any || (m_history[step].next_pass < due))){
+					due = m_history[step].next_pass;
+					any = true;
+				}
+			}
+			return std::max(due, m_pass);
+		}
+		
+		/* Shares the steps out evenly between the devices */
+		void Split()
+		{
+			for (size_t i = 0; i < m_ranges.size(); i++){
+				m_ranges[i].next = m_steps * i / m_ranges.size();
+				m_ranges[i].end = m_steps * (i + 1) / m_ranges.size();
+			}
+		}
+		
+		boost::mutex m_mutex;
+		double m_centre_freq_1;
+		double m_step;
+		unsigned long m_steps;
+		std::vector<double> m_freqs; //the frequencies to visit, if they aren't evenly spaced
+		std::vector<Range> m_ranges;
+		std::vector<std::vector<bool> > m_holes;
+		std::vector<History> m_history; //for each step, if we're adapting to what we find
+		unsigned int m_passes;
+		unsigned int m_pass;
+		unsigned int m_range_pass;
+		unsigned int m_idle;
+		unsigned int m_active;
+		unsigned long m_visits;
+		double m_pass_started;
+		double m_pass_seconds;
+		double m_resume;
+		bool m_finished;
+};
+
+typedef boost::shared_ptr<SweepPlan> sweep_plan_sptr;
+
+#endif
@@ -17,54 +17,335 @@
 */
 
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <stdexcept>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
+#include <gnuradio/prefs.h>
 #include <gnuradio/top_block.h>
 #include <osmosdr/source.h>
 #include <gnuradio/blocks/stream_to_vector.h>
 #include <gnuradio/fft/fft_vcc.h>
 #include <gnuradio/blocks/complex_to_mag_squared.h>
-#include <gnuradio/filter/single_pole_iir_filter_ff.h>
 #include <gnuradio/blocks/nlog10_ff.h>
+#include "batch_fft.hpp"
+#include "goertzel_bank.hpp"
+#include "replay_source.hpp"
+#ifdef HAVE_RTLSDR
+#include "rtl_source.hpp"
+#endif
 #include "scanner_sink.hpp"
 
 class TopBlock : public gr::top_block
 {
 	public:
-		TopBlock(double centre_freq_1, double centre_freq_2, double sample_rate, double fft_width, double bandwidth1, double bandwidth2,
-				double step, unsigned int avg_size, double spread, double threshold, double ptime) : gr::top_block("Top Block"),
-			vector_length(sample_rate/fft_width),
-			window(GetWindow(vector_length)),
+		/* What to scan and how (the defaults are gr-scan's own) */
+		struct Settings {
+			Settings() :
+				centre_freq_1(87000000.0),
+				centre_freq_2(108000000.0),
+				sample_rate(2000000.0),
+				fft_width(1000.0),
+				bandwidth1(25000.0),
+				bandwidth2(200000.0),
+				step(500000.0),
+				avg_size(1000),
+				spread(50000.0),
+				threshold(3.0),
+				ptime(-1.0),
+				db_average(false),
+				queue_size(16),
+				settle(0),
+				use_tags(false),
+				stitch(0.0),
+				max_signals(100000),
+				max_age(0.0),
+				passes(1),
+				zoom(1),
+				adaptive(false),
+				fft_threads(1),
+				fft_batch(1),
+				metrics_period(5.0),
+				detector("window"),
+				cu8(false),
+				overlap(0.0)
+			{
+			}
 			
-			source(osmosdr::source::make()), /* OsmoSDR Source */
-			stv(gr::blocks::stream_to_vector::make(sizeof(float)*2, vector_length)), /* Stream to vector */
-			/* Based on the logpwrfft (a block implemented in python) */
-			fft(gr::fft::fft_vcc::make(vector_length, true, window, false, 1)),
-			ctf(gr::blocks::complex_to_mag_squared::make(vector_length)),
-			iir(gr::filter::single_pole_iir_filter_ff::make(1.0, vector_length)),
-			lg(gr::blocks::nlog10_ff::make(10, vector_length, -20 * std::log10(float(vector_length)) -10 * std::log10(float(GetWindowPower()/vector_length)))),
-			/* Sink - this does most of the interesting work */
-			sink(make_scanner_sink(source, vector_length, centre_freq_1, centre_freq_2, sample_rate, bandwidth1, bandwidth2, step, avg_size, spread, threshold, ptime))
+			double centre_freq_1; //first step (Hz)
+			double centre_freq_2; //last step
+			double sample_rate; //samples per second
+			double fft_width; //Hz per bin
+			double bandwidth1; //fine window (Hz)
+			double bandwidth2; //coarse window
+			double step; //between the centres of the steps (Hz)
+			unsigned int avg_size; //FFTs averaged in each spectrum
+			double spread; //least distance between signals (Hz)
+			double threshold; //dB
+			double ptime; //seconds to listen on each frequency (or -1 for one spectrum)
+			bool db_average; //whether to average in dB rather than power
+			std::vector<std::string> devices; //OsmoSDR (or with cu8, RTL) device strings, one per radio
+			std::vector<std::string> replays; //capture indexes to play back instead of using radios
+			size_t queue_size; //spectra that can wait for detection
+			unsigned int settle; //samples to drop after each retune
+			bool use_tags; //whether to wait for the source's rx_freq tag after each retune
+			double stitch; //fraction of each step's band to join up with the next (0 for none)
+			size_t max_signals; //signals to remember (0 for no limit)
+			double max_age; //seconds until a signal not seen again is forgotten (0 for never)
+			unsigned int passes; //sweeps to make (0 for until interrupted)
+			unsigned int zoom; //how much smaller the quick sweep's FFT is (1 for no quick sweep)
+			bool adaptive; //whether to stop averaging once it's clear what's there
+			unsigned int fft_threads;
+			unsigned int fft_batch; //FFTs transformed at a time
+			std::string metrics_target; //file or unix:PATH to publish metrics to, if set
+			double metrics_period; //seconds between metrics files
+			std::string spectrum_log; //file to log every averaged spectrum to, if set
+			std::string detector; //see MakeDetector
+			bool cu8; //whether the samples stay unsigned 8 bit until they're windowed
+			double overlap; //fraction of each FFT's samples that the next one starts with
+			std::string control_socket; //UNIX socket to take commands on, if set
+			std::string watchlist; //file of channels to watch instead of sweeping, if set
+		};
+		
+		TopBlock(const Settings &settings) : gr::top_block("Top Block"),
+			centre_freq_1(settings.centre_freq_1),
+			centre_freq_2(settings.centre_freq_2),
+			sample_rate(settings.sample_rate),
+			fft_width(settings.fft_width),
+			bandwidth1(settings.bandwidth1),
+			bandwidth2(settings.bandwidth2),
+			step(settings.step),
+			avg_size(settings.avg_size),
+			spread(settings.spread),
+			threshold(settings.threshold),
+			ptime(settings.ptime),
+			db_average(settings.db_average),
+			queue_size(settings.queue_size),
+			settle(settings.settle),
+			use_tags(settings.use_tags),
+			stitch(settings.stitch),
+			max_signals(settings.max_signals),
+			max_age(settings.max_age),
+			passes(settings.passes),
+			zoom(settings.zoom),
+			adaptive(settings.adaptive),
+			fft_threads(settings.fft_threads),
+			fft_batch(settings.fft_batch),
+			detector(settings.detector),
+			cu8(settings.cu8),
+			overlap(settings.overlap),
+			metrics(new Metrics()),
+			started(Now())
 		{
-			/* Set up the OsmoSDR Source */
-			source->set_sample_rate(sample_rate);
-			source->set_center_freq(centre_freq_1);
-			source->set_freq_corr(0.0);
-			source->set_gain_mode(false);
-			source->set_gain(10.0);
-			source->set_if_gain(20.0);
+			if (!settings.metrics_target.empty()){
+				gr::prefs::singleton()->set_bool("PerfCounters", "on", true); //so the blocks time their work
+				metrics->Start(settings.metrics_target, settings.metrics_period);
+			}
+			if (!settings.spectrum_log.empty()){
+				log.reset(new SpectrumLogWriter(settings.spectrum_log));
+			}
+			if (!settings.watchlist.empty()){ //keep an eye on just these channels, rather than the whole range
+				watchlist.reset(new Watchlist(settings.watchlist));
+				watchlist->Group(sample_rate, spread);
+				fprintf(stderr, "[*] Watching %u channels in %u windows\n", (unsigned int)watchlist->Size(), (unsigned int)watchlist->Windows().size());
+			}
+			if (!settings.control_socket.empty()){ //take commands to change what we're doing as we go
+				Control::Settings initial = {centre_freq_1, centre_freq_2, step, threshold, avg_size, ptime, NAN};
+				control.reset(new Control(initial));
+				if (stitch > 0.0){
+					control->SetMaxSpan(centre_freq_2 - centre_freq_1);
+				}
+				control->Start(settings.control_socket);
+			}
 			
-			/* Set up the connections */
-			connect(source, 0, stv, 0);
-			connect(stv, 0, fft, 0);
-			connect(fft, 0, ctf, 0);
-			connect(ctf, 0, iir, 0);
-			connect(iir, 0, lg, 0);
-			connect(lg, 0, sink, 0);
+			const std::vector<std::string> &devices = settings.devices;
+			const std::vector<std::string> &replays = settings.replays;
+			if (replays.empty() && cu8){
+#ifdef HAVE_RTLSDR
+				for (size_t i = 0; i < std::max<size_t>(devices.size(), 1); i++){
+					/* Read RTL dongles directly, so the samples stay as 8 bits */
+					rtl_source_sptr source = make_rtl_source(devices.empty() ? "" : devices[i], sample_rate);
+					sources.push_back(source);
+					tuners.push_back(source);
+				}
+#else
+				throw std::runtime_error("reading RTL devices as 8 bit needs gr-scan built with librtlsdr");
+#endif
+			}
+			else if (replays.empty()){
+				for (size_t i = 0; i < std::max<size_t>(devices.size(), 1); i++){
+					/* Set up the OsmoSDR Source */
+					osmosdr::source::sptr source = osmosdr::source::make(devices.empty() ? "" : devices[i]);
+					source->set_sample_rate(sample_rate);
+					source->set_freq_corr(0.0);
+					source->set_gain_mode(false);
+					source->set_gain(10.0);
+					source->set_if_gain(20.0);
+					sources.push_back(source);
+					tuners.push_back(make_osmosdr_tuner(source));
+				}
+			}
+			else {
+				for (size_t i = 0; i < replays.size(); i++){
+					/* Play back captures instead (the sample rate must match the one they were recorded at) */
+					replay_source_sptr player = make_replay_source(replays[i], cu8 ? replay_source::CU8 : replay_source::CF32);
+					sources.push_back(player);
+					tuners.push_back(player);
+				}
+			}
+		}
+		
+		~TopBlock()
+		{
+			metrics->Stop(); //write the last snapshot, or take the socket away (the sinks may hold on to the metrics for longer)
+			if (log){
+				log->Close(); //likewise the detection workers and the spectrum log
+			}
+			if (control){
+				control->Stop(); //and the control socket
+			}
+		}
+		
+		/* Sweeps the range - if zooming, quickly at low resolution first, then at full resolution just around what that found */
+		void Run()
+		{
+			size_t vector_length = sample_rate/fft_width;
+			sweep_plan_sptr plan(watchlist ? new SweepPlan(watchlist->Centres(), sources.size(), passes, adaptive) :
+				new SweepPlan(centre_freq_1, centre_freq_2, step, sources.size(), passes, adaptive));
+			if (zoom <= 1){
+				Sweep(vector_length, avg_size, plan, stdout);
+				return;
+			}
+			
+			/* An FFT zoom times smaller, averaged zoom times fewer times, gets through each step zoom squared times faster */
+			fprintf(stderr, "[*] Looking for candidates with a %u point FFT\n", (unsigned int)(vector_length / zoom));
+			detection_worker_sptr coarse = Sweep(vector_length / zoom, std::max(avg_size / zoom, 1u), plan, 0);
+			if (scanner_sink::Stopped()){
+				return;
+			}
+			
+			/*
+			 * Centre a step about a quarter of the sample rate above each candidate (in the flat part of the filter, clear of the DC spike),
+			 * skipping candidates an earlier step covers. Steps stay on the quick sweep's grid, where we know we can tune.
+			 */
+			std::vector<Signal> candidates;
+			std::vector<double> freqs;
+			coarse->Signals(candidates);
+			for (size_t i = 0; i < candidates.size(); i++){
+				if (!freqs.empty()){
+					double offset = candidates[i].mid - freqs.back();
+					if ((std::fabs(offset) <= sample_rate/4.0) && (std::fabs(offset) >= spread)){
+						continue;
+					}
+				}
+				freqs.push_back(centre_freq_1 + std::floor((candidates[i].mid + sample_rate/4.0 - centre_freq_1) / step + 0.5) * step);
+			}
+			
+			fprintf(stderr, "[*] Zooming in on %u candidates in %u steps\n", (unsigned int)candidates.size(), (unsigned int)freqs.size());
+			if (!freqs.empty()){
+				Sweep(vector_length, avg_size, sweep_plan_sptr(new SweepPlan(freqs, sources.size(), 1, adaptive)), stdout);
+			}
 		}
 		
 	private:
+		/* Runs the flowgraph with an FFT of vector_length over the steps in plan, returning the detection worker (which is finished with by then) */
+		detection_worker_sptr Sweep(size_t vector_length, unsigned int avg_size, sweep_plan_sptr plan, FILE *output)
+		{
+			SetWindow(vector_length);
+			float log_offset = -20 * std::log10(float(vector_length)) -10 * std::log10(float(window_power/vector_length)); //the same however much the FFTs overlap
+			size_t hop = std::max<size_t>(vector_length * (1.0 - overlap) + 0.5, 1); //samples from the start of one FFT to the next
+			double worth = GetFrameWorth(hop);
+			if (hop < vector_length){
+				fprintf(stderr, "[*] Overlapping FFTs by %.0f%%, each is worth %.2f of an independent one (so the same variance takes %.0f%% of the samples)\n",
+					100.0 * (vector_length - hop) / vector_length, worth, 100.0 * hop / (vector_length * worth));
+			}
+			
+			/* Detection - this does most of the interesting work, for every device (it takes the log itself unless we average in dB) */
+			detection_worker_sptr worker(new DetectionWorker(vector_length, queue_size, sources.size(), sample_rate, bandwidth1, bandwidth2, avg_size, spread, threshold, !db_average,
+				log_offset, centre_freq_1, centre_freq_2, stitch, max_signals, max_age, passes));
+			worker->SetOutput(output);
+			worker->SetStarted(started);
+			worker->SetLog(log);
+			worker->SetDetector(detector);
+			worker->SetFrameWorth(worth);
+			worker->SetControl(control);
+			worker->SetWatchlist(watchlist);
+			metrics->SetWorker(worker);
+			started = 0.0; //only the first sweep's first spectrum is worth reporting
+			
+			disconnect_all(); //anything left from an earlier sweep
+			double begin = Now();
+			for (size_t i = 0; i < sources.size(); i++){
+				AddChain(i, vector_length, hop, avg_size, log_offset, worker, plan);
+			}
+			fprintf(stderr, "[*] Set up %u point FFTs in %.3f seconds\n", (unsigned int)vector_length, Now() - begin);
+			run(); //returns once the sinks have got through the plan, or been interrupted
+			return worker;
+		}
+		
+		/* Sets up the FFT chain and sink for one device */
+		void AddChain(unsigned int device, size_t vector_length, size_t hop, unsigned int avg_size, float log_offset, detection_worker_sptr worker,
+				sweep_plan_sptr plan)
+		{
+			/* Set up the connections */
+			gr::basic_block_sptr power; //where the power spectra come from
+			tuner_sptr tuner = tuners[device];
+			if (watchlist){ //just the bins the watched channels are in
+				goertzel_bank_sptr bank = make_goertzel_bank(vector_length, hop, sample_rate, window, watchlist, cu8);
+				if (device == 0){
+					fprintf(stderr, "[*] Working out %u of the %u windows with Goertzel filters (at most %u of the %u bins each), and the rest with an FFT\n", bank->Filtered(),
+						(unsigned int)watchlist->Windows().size(), (unsigned int)bank->MostBins(), (unsigned int)vector_length);
+				}
+				power = bank;
+				tuner = make_goertzel_tuner(tuner, bank); //the bank needs to know which channels are in view
+				connect(sources[device], 0, power, 0);
+				metrics->AddBlock("goertzel", device, power);
+			}
+			else if ((fft_batch > 1) || cu8 || (hop < vector_length)){ //batches of (maybe overlapping) FFTs shared out between threads, straight from the samples to power spectra
+				power = make_batch_fft(vector_length, hop, window, fft_threads, fft_batch, cu8);
+				connect(sources[device], 0, power, 0);
+				metrics->AddBlock("fft", device, power);
+			}
+			else { //one FFT at a time, with FFTW splitting each between the threads
+				/* Based on the logpwrfft (a block implemented in python) */
+				gr::blocks::stream_to_vector::sptr stv = gr::blocks::stream_to_vector::make(sizeof(float)*2, vector_length); /* Stream to vector */
+				gr::fft::fft_vcc::sptr fft = gr::fft::fft_vcc::make(vector_length, true, window, false, fft_threads);
+				power = gr::blocks::complex_to_mag_squared::make(vector_length);
+				connect(sources[device], 0, stv, 0);
+				connect(stv, 0, fft, 0);
+				connect(fft, 0, power, 0);
+				metrics->AddBlock("stv", device, stv);
+				metrics->AddBlock("fft", device, fft);
+				metrics->AddBlock("mag2", device, power);
+			}
+			
+			/* Sink - this averages the FFTs and retunes the device */
+			scanner_sink_sptr sink = make_scanner_sink(tuner, worker, plan, metrics, control, device, vector_length, hop, sample_rate, avg_size, ptime,
+				settle, use_tags, adaptive);
+			if (db_average){ //take the log of every FFT, so the sink averages dB values
+				gr::blocks::nlog10_ff::sptr lg = gr::blocks::nlog10_ff::make(10, vector_length, log_offset);
+				connect(power, 0, lg, 0);
+				connect(lg, 0, sink, 0);
+				metrics->AddBlock("log", device, lg);
+			}
+			else { //the sink sums power and takes the log once per averaged spectrum
+				connect(power, 0, sink, 0);
+			}
+			metrics->AddBlock("source", device, sources[device]); //unless it's a hier block, like the OsmoSDR source
+			metrics->AddBlock("sink", device, sink);
+		}
+		
+		/* Sets window (and window_power) to a Blackman window of n samples */
+		void SetWindow(size_t n)
+		{
+			window = GetWindow(n);
+			window_power = GetWindowPower();
+		}
+		
 		/* http://en.wikipedia.org/w/index.php?title=Window_function&oldid=508445914 */
 		std::vector<float> GetWindow(size_t n)
 		{
@@ -82,6 +363,23 @@ class TopBlock : public gr::top_block
 			return w;
 		}
 		
+		/*
+		 * How many independent FFTs each of a long run of FFTs hop samples apart is worth, for noise: overlapping frames share samples,
+		 * weighted by the window in each, so their powers are correlated (Welch, 1967)
+		 */
+		double GetFrameWorth(size_t hop)
+		{
+			double correlation = 0.0; //with all the later frames it overlaps
+			for (size_t lag = hop; lag < window.size(); lag += hop){
+				double total = 0.0;
+				for (size_t i = 0; i + lag < window.size(); i++){
+					total += window[i] * window[i + lag];
+				}
+				correlation += (total / window_power) * (total / window_power);
+			}
+			return 1.0 / (1.0 + 2.0 * correlation);
+		}
+		
 		double GetWindowPower()
 		{
 			double total = 0.0;
@@ -91,14 +389,40 @@ class TopBlock : public gr::top_block
 			return total;
 		}
 		
-		size_t vector_length;
-		std::vector<float> window;
+		double centre_freq_1;
+		double centre_freq_2;
+		double sample_rate;
+		double fft_width;
+		double bandwidth1;
+		double bandwidth2;
+		double step;
+		unsigned int avg_size;
+		double spread;
+		double threshold;
+		double ptime;
+		bool db_average;
+		size_t queue_size;
+		unsigned int settle;
+		bool use_tags;
+		double stitch;
+		size_t max_signals;
+		double max_age;
+		unsigned int passes;
+		unsigned int zoom;
+		bool adaptive;
+		unsigned int fft_threads;
+		unsigned int fft_batch;
+		std::string detector;
+		bool cu8; //whether the samples stay unsigned 8 bit until they're windowed
+		double overlap; //fraction of each FFT's samples that the next one starts with
+		metrics_sptr metrics;
+		spectrum_log_writer_sptr log; //every averaged spectrum goes here too, if set
+		control_sptr control; //takes commands while we sweep, if set
+		watchlist_sptr watchlist; //the channels to watch instead of sweeping the range, if set
+		double started; //when we started, until the first sweep's been set up
 		
-		osmosdr::source::sptr source;
-		gr::blocks::stream_to_vector::sptr stv;
-		gr::fft::fft_vcc::sptr fft;
-		gr::blocks::complex_to_mag_squared::sptr ctf;
-		gr::filter::single_pole_iir_filter_ff::sptr iir;
-		gr::blocks::nlog10_ff::sptr lg;
-		scanner_sink_sptr sink;
+		std::vector<gr::basic_block_sptr> sources;
+		std::vector<tuner_sptr> tuners;
+		std::vector<float> window;
+		double window_power;
 };
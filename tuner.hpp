@@ -0,0 +1,172 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef TUNER_HPP
+#define TUNER_HPP
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <osmosdr/source.h>
+
+/* Something the sink can retune: a radio, or a recording of one */
+class Tuner
+{
+	public:
+		virtual ~Tuner()
+		{
+		}
+		
+		virtual double set_center_freq(double freq) = 0; //returns the frequency we actually ended up on
+		virtual double set_gain(double gain) = 0; //in dB, returning the gain we actually ended up with
+};
+
+typedef boost::shared_ptr<Tuner> tuner_sptr;
+
+/* Retunes an OsmoSDR source */
+class osmosdr_tuner : public Tuner
+{
+	public:
+		osmosdr_tuner(osmosdr::source::sptr source) :
+			m_source(source)
+		{
+		}
+		
+		virtual double set_center_freq(double freq)
+		{
+			return m_source->set_center_freq(freq);
+		}
+		
+		virtual double set_gain(double gain)
+		{
+			return m_source->set_gain(gain);
+		}
+		
+	private:
+		osmosdr::source::sptr m_source;
+};
+
+tuner_sptr make_osmosdr_tuner(osmosdr::source::sptr source)
+{
+	return tuner_sptr(new osmosdr_tuner(source));
+}
+
+/*
+ * Retunes a tuner on a thread of its own, so whoever asked can get on with something else (like handing
+ * over the spectrum it's just finished, and keeping up with the samples) while the radio is busy, and
+ * look in with Done now and then. Only one retune is in flight at a time.
+ */
+class Retuner
+{
+	public:
+		Retuner(tuner_sptr tuner) :
+			m_tuner(tuner),
+			m_freq(0.0), //frequency asked for
+			m_actual(0.0), //frequency the tuner ended up on
+			m_seconds(0.0), //how long it took
+			m_pending(false), //whether there's a retune waiting for the thread
+			m_done(true), //whether the last retune has finished
+			m_stop(false)
+		{
+			m_thread = boost::thread(&Retuner::Run, this);
+		}
+		
+		~Retuner()
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_one();
+			m_thread.join();
+		}
+		
+		/* Starts retuning to freq */
+		void Start(double freq)
+		{
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				m_freq = freq;
+				m_pending = true;
+				m_done = false;
+			}
+			m_wake.notify_one();
+		}
+		
+		/* Whether the retune's finished, giving the frequency it ended up on and how long it took if it has (never waits) */
+		bool Done(double &actual, double &seconds)
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (!m_done){
+				return false;
+			}
+			actual = m_actual;
+			seconds = m_seconds;
+			return true;
+		}
+		
+		/* Sets the tuner's gain in dB, returning what it ended up as (only once Done and before the next Start, so it never races a retune) */
+		double SetGain(double gain)
+		{
+			return m_tuner->set_gain(gain);
+		}
+		
+	private:
+		void Run()
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while (true){
+				while (!m_stop && !m_pending){
+					m_wake.wait(lock);
+				}
+				if (m_stop){
+					return;
+				}
+				
+				double freq = m_freq;
+				m_pending = false;
+				lock.unlock();
+				boost::posix_time::ptime before = boost::posix_time::microsec_clock::universal_time();
+				double actual = m_tuner->set_center_freq(freq);
+				double seconds = (boost::posix_time::microsec_clock::universal_time() - before).total_microseconds() / 1e6;
+				lock.lock();
+				
+				m_actual = actual;
+				m_seconds = seconds;
+				m_done = true;
+			}
+		}
+		
+		tuner_sptr m_tuner;
+		double m_freq;
+		double m_actual;
+		double m_seconds;
+		bool m_pending;
+		bool m_done;
+		bool m_stop;
+		boost::mutex m_mutex;
+		boost::condition_variable m_wake;
+		boost::thread m_thread;
+};
+
+typedef boost::shared_ptr<Retuner> retuner_sptr;
+
+#endif
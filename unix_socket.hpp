@@ -0,0 +1,71 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UNIX_SOCKET_HPP
+#define UNIX_SOCKET_HPP
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Listens on the UNIX socket path, replacing a socket left over from a run that didn't finish (but
+ * nothing else). If mode isn't 0 the socket is given it before anyone can connect, otherwise it gets
+ * whatever the umask allows. Errors are thrown, prefixed with who's listening.
+ */
+static int ListenUnix(const std::string &path, const char *who, mode_t mode = 0)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)){
+		throw std::runtime_error(std::string(who) + ": socket path too long: " + path);
+	}
+	strcpy(address.sun_path, path.c_str());
+	
+	struct stat existing;
+	if (lstat(path.c_str(), &existing) == 0){
+		if (!S_ISSOCK(existing.st_mode)){
+			throw std::runtime_error(std::string(who) + ": won't replace " + path + " with a socket, as it isn't one");
+		}
+		unlink(path.c_str());
+	}
+	
+	/* nobody can connect until listen(), so changing the mode in between leaves no gap */
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	bool bound = (listener >= 0) && (bind(listener, (struct sockaddr *)&address, sizeof(address)) == 0);
+	if (!bound || ((mode != 0) && (chmod(path.c_str(), mode) < 0)) || (listen(listener, 4) < 0)){
+		std::string error = strerror(errno);
+		if (listener >= 0){
+			close(listener);
+		}
+		if (bound){
+			unlink(path.c_str());
+		}
+		throw std::runtime_error(std::string(who) + ": can't listen on " + path + ": " + error);
+	}
+	return listener;
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+	gr-scan - A GNU Radio signal scanner
+	Copyright (C) 2012  Nicholas Tomlinson
+	
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>. 
+*/
+
+#ifndef WATCHLIST_HPP
+#define WATCHLIST_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+/* A channel to keep an eye on */
+struct Channel {
+	double freq; //centre (Hz)
+	double width; //Hz
+	
+	bool operator<(const Channel &other) const
+	{
+		return freq < other.freq;
+	}
+};
+
+/*
+ * The channels to watch instead of sweeping a range, listed one per line in a file:
+ *
+ *	<centre frequency in MHz> <width in kHz>
+ *
+ * Blank lines and lines starting with # are ignored. The channels are grouped into as few tuning
+ * windows as will hold them, each channel with a reference band as wide as itself either side (what
+ * its power is judged against). Everything has to be in the middle 80% of a window, clear of the
+ * filter's roll-off, and at least spread from the centre, clear of the DC spike.
+ */
+class Watchlist
+{
+	public:
+		struct Window {
+			double centre; //frequency to tune to
+			std::vector<Channel> channels;
+		};
+		
+		Watchlist()
+		{
+		}
+		
+		Watchlist(const std::string &file)
+		{
+			Load(file);
+		}
+		
+		void AddChannel(double freq, double width)
+		{
+			Channel channel = {freq, width};
+			m_channels.push_back(channel);
+		}
+		
+		/* Shares the channels out between windows for a device sampling at sample_rate, starting each window at the lowest channel left */
+		void Group(double sample_rate, double spread)
+		{
+			double half = 0.4 * sample_rate; //usable either side of the centre
+			std::sort(m_channels.begin(), m_channels.end());
+			m_windows.clear();
+			m_centres.clear();
+			
+			std::vector<bool> placed(m_channels.size());
+			for (size_t first = 0; first < m_channels.size(); first++){
+				if (placed[first]){
+					continue;
+				}
+				const Channel &lowest = m_channels[first];
+				if (3.0 * lowest.width + spread > half){
+					throw std::runtime_error("watchlist: a channel is too wide to watch at this sample rate");
+				}
+				
+				Window window;
+				window.centre = lowest.freq - 1.5 * lowest.width + half; //the lowest channel's reference band at the bottom of the window
+				for (size_t i = first; (i < m_channels.size()) && (m_channels[i].freq < window.centre + half); i++){
+					double low = m_channels[i].freq - 1.5 * m_channels[i].width;
+					double high = m_channels[i].freq + 1.5 * m_channels[i].width;
+					bool inside = (low >= window.centre - half) && (high <= window.centre + half); //reference bands and all (a wide channel just above a narrow one may not be)
+					bool clear = (high <= window.centre - spread) || (low >= window.centre + spread); //not across the DC spike
+					if (!placed[i] && ((i == first) || (inside && clear))){ //the lowest fits by construction; anything else that doesn't starts a later window
+						window.channels.push_back(m_channels[i]);
+						placed[i] = true;
+					}
+				}
+				m_centres[window.centre] = m_windows.size();
+				m_windows.push_back(window);
+			}
+		}
+		
+		const std::vector<Window> &Windows()
+		{
+			return m_windows;
+		}
+		
+		/* The windows' centres, in order, for the sweep plan */
+		std::vector<double> Centres()
+		{
+			std::vector<double> centres;
+			for (size_t i = 0; i < m_windows.size(); i++){
+				centres.push_back(m_windows[i].centre);
+			}
+			return centres;
+		}
+		
+		/* The index of the window tuned to centre, or -1 if there isn't one */
+		int Find(double centre)
+		{
+			std::map<double, size_t>::iterator it = m_centres.lower_bound(centre - 1.0);
+			if ((it == m_centres.end()) || (it->first > centre + 1.0)){
+				return -1;
+			}
+			return it->second;
+		}
+		
+		size_t Size()
+		{
+			return m_channels.size();
+		}
+		
+		/* The bin (of n, with 0 Hz in the middle) that offset Hz from the centre falls in, for bins binwidth Hz apart */
+		static unsigned int Bin(double offset, double binwidth, unsigned int n)
+		{
+			long bin = n/2 + (long)std::floor(offset / binwidth + 0.5);
+			return std::min(std::max(bin, 0L), (long)n - 1);
+		}
+		
+		/* The bins a channel covers in a window tuned to centre, from first to last (one past), and its reference bands, from lowest to first and from last to end (at least a bin each) */
+		static void Bins(const Channel &channel, double centre, double binwidth, unsigned int n, unsigned int &lowest, unsigned int &first,
+			unsigned int &last, unsigned int &end)
+		{
+			first = Bin(channel.freq - channel.width/2.0 - centre, binwidth, n);
+			last = Bin(channel.freq + channel.width/2.0 - centre, binwidth, n) + 1;
+			lowest = std::min(Bin(channel.freq - 1.5 * channel.width - centre, binwidth, n), first - std::min(first, 1u));
+			end = std::min(std::max(Bin(channel.freq + 1.5 * channel.width - centre, binwidth, n) + 1, last + 1), n);
+		}
+		
+	private:
+		void Load(const std::string &file)
+		{
+			FILE *list = fopen(file.c_str(), "r");
+			if (!list){
+				throw std::runtime_error("watchlist: can't open " + file);
+			}
+			
+			char line[256];
+			while (fgets(line, sizeof(line), list)){
+				double freq, width;
+				if ((line[0] == '#') || (sscanf(line, "%lf %lf", &freq, &width) != 2)){
+					continue; //comment or blank line
+				}
+				AddChannel(freq * 1000000.0, width * 1000.0); //MHz, kHz
+			}
+			fclose(list);
+			
+			if (m_channels.empty()){
+				throw std::runtime_error("watchlist: no channels listed in " + file);
+			}
+		}
+		
+		std::vector<Channel> m_channels; //in order of frequency once grouped
+		std::vector<Window> m_windows;
+		std::map<double, size_t> m_centres; //window index by centre frequency
+};
+
+typedef boost::shared_ptr<Watchlist> watchlist_sptr;
+
+#endif